@@ -0,0 +1,105 @@
+#!/bin/bash
+#
+# Runs each perf test against snmalloc, the system allocator and any other
+# allocators found on the machine, and prints one table comparing them.
+#
+#   compare.sh <build directory> [test ...]
+#
+# Each test is run as its native snmalloc build (perf-<test>-1) and as its
+# pass-through build (perf-<test>-malloc), which uses the system allocator.
+# The pass-through build is also run with each of the allocators in
+# SNMALLOC_COMPARE_PRELOAD, a space separated list of name=library pairs,
+# loaded with LD_PRELOAD.  If SNMALLOC_COMPARE_PRELOAD is not set, the
+# jemalloc, tcmalloc and mimalloc libraries known to the dynamic linker are
+# used.  SNMALLOC_COMPARE_ARGS is passed to every test.
+#
+# Throughput, peak RSS and page faults are taken from the lines the tests
+# print with usage::Measure, and tail latency from their
+# "latency (ticks): ... p99 <n>" lines.  Values are "-" where a test does
+# not report them.
+
+set -u
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 <build directory> [test ...]" >&2
+  exit 2
+fi
+
+BUILD=$1
+shift
+
+if [ $# -gt 0 ]; then
+  TESTS="$*"
+else
+  TESTS=$(cd "$BUILD" && ls perf-*-1 2>/dev/null | sed -e 's/^perf-//' -e 's/-1$//')
+fi
+
+if [ -z "$TESTS" ]; then
+  echo "No perf tests found in $BUILD" >&2
+  exit 2
+fi
+
+PRELOAD=${SNMALLOC_COMPARE_PRELOAD-}
+if [ -z "${SNMALLOC_COMPARE_PRELOAD+set}" ] && command -v ldconfig > /dev/null; then
+  for lib in jemalloc tcmalloc mimalloc; do
+    path=$(ldconfig -p | awk -v lib="lib$lib.so" '$1 ~ "^" lib { print $NF; exit }')
+    if [ -n "$path" ]; then
+      PRELOAD="$PRELOAD $lib=$path"
+    fi
+  done
+fi
+
+# Summarise the output of one run on stdin as
+#   ops/s peak-RSS-KiB minor-faults/op p99
+summarise() {
+  awk '
+    / ops\/s, RSS / {
+      ops = $1; rate = $3; peak = $10
+      if (rate > 0) { total_ops += ops; total_s += ops / rate }
+      if (peak > max_peak) max_peak = peak
+      total_faults += $14 * ops
+    }
+    /latency \(ticks\):/ {
+      for (i = 1; i < NF; i++)
+        if ($i == "p99") { v = $(i + 1); sub(",", "", v); v += 0; if (v > p99) p99 = v; seen = 1 }
+    }
+    END {
+      if (total_s > 0)
+        printf "%.0f %d %.4f", total_ops / total_s, max_peak, total_faults / total_ops
+      else
+        printf "- - -"
+      if (seen) printf " %d\n", p99; else printf " -\n"
+    }'
+}
+
+# run <test> <allocator> <binary> [preload]
+run() {
+  local test=$1 allocator=$2 binary=$3 preload=${4-}
+  if [ ! -x "$BUILD/$binary" ]; then
+    return
+  fi
+
+  local start end out status
+  start=$(date +%s%N)
+  out=$(cd "$BUILD" && LD_PRELOAD=$preload ./$binary ${SNMALLOC_COMPARE_ARGS-} 2>&1)
+  status=$?
+  end=$(date +%s%N)
+
+  local summary
+  summary=$(echo "$out" | summarise)
+  if [ $status -ne 0 ]; then
+    summary="failed($status) - - -"
+  fi
+  printf "%-20s %-12s %10.2f %14s %12s %10s %10s\n" "$test" "$allocator" \
+    "$(awk -v ns=$((end - start)) 'BEGIN { print ns / 1e9 }')" $summary
+}
+
+printf "%-20s %-12s %10s %14s %12s %10s %10s\n" \
+  test allocator "wall (s)" "ops/s" "peak KiB" "faults/op" "p99"
+for test in $TESTS; do
+  run "$test" snmalloc "perf-$test-1"
+  run "$test" system "perf-$test-malloc"
+  for entry in $PRELOAD; do
+    run "$test" "${entry%%=*}" "perf-$test-malloc" "${entry#*=}"
+  done
+done
@@ -50,6 +50,24 @@
 
 #define UNUSED(x) ((void)(x))
 
+/**
+ * Static (USDT) tracepoints, for attributing latency to the allocator's slow
+ * paths with tools such as bpftrace without rebuilding.  The probes are in
+ * the `snmalloc` provider, and compile to a single nop.  They are only
+ * present when `SNMALLOC_USDT` is defined and the platform provides
+ * `<sys/sdt.h>`; otherwise the arguments are not evaluated.
+ */
+#if defined(SNMALLOC_USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define SNMALLOC_TRACEPOINT(name, ...) \
+      STAP_PROBEV(snmalloc, name, __VA_ARGS__)
+#  endif
+#endif
+#ifndef SNMALLOC_TRACEPOINT
+#  define SNMALLOC_TRACEPOINT(name, ...)
+#endif
+
 namespace snmalloc
 {
   // Forwards reference so that the platform can define how to handle errors.
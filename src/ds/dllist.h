@@ -150,6 +150,16 @@ namespace snmalloc
 #endif
     }
 
+    /**
+     * Call `f` on each item, from the head.  `f` must not change the list.
+     */
+    template<typename F>
+    void for_each(F f)
+    {
+      for (Ptr<T> curr = head; curr != Terminator(); curr = curr->next)
+        f(curr);
+    }
+
     void clear()
     {
       while (head != nullptr)
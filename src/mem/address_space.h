@@ -196,8 +196,11 @@ namespace snmalloc
         pal_supports<AlignedAllocation, PAL> && !aal_supports<StrictProvenance>)
       {
         if (size >= PAL::minimum_alloc_size)
+        {
+          SNMALLOC_TRACEPOINT(reserve, size, size);
           return CapPtr<void, CBChunk>(
             PAL::template reserve_aligned<committed>(size));
+        }
       }
 
       CapPtr<void, CBChunk> res;
@@ -278,6 +281,7 @@ namespace snmalloc
             return nullptr;
           }
           add_range(block, block_size);
+          SNMALLOC_TRACEPOINT(reserve, size, block_size);
 
           // still holding lock so guaranteed to succeed.
           res = remove_block(bits::next_pow2_bits(size));
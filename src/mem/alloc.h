@@ -10,15 +10,18 @@
 #include "allocstats.h"
 #include "chunkmap.h"
 #include "external_alloc.h"
+#include "heapprofile.h"
 #include "largealloc.h"
 #include "mediumslab.h"
 #include "pooled.h"
 #include "remoteallocator.h"
 #include "sizeclasstable.h"
 #include "slab.h"
+#include "tagmap.h"
 
 #include <array>
 #include <functional>
+#include <utility>
 
 namespace snmalloc
 {
@@ -52,6 +55,61 @@ namespace snmalloc
     FastFreeLists() : small_fast_free_lists() {}
   };
 
+  /**
+   * Work to run once, on whichever thread next finishes an allocation, for
+   * code that may itself allocate and so cannot run inside the allocator or
+   * from the static initialisers of the malloc shim, such as starting a
+   * background thread.  Allocators look for it on the heap profiler's
+   * sampling slow path, so it adds nothing to the fast path.  Schedule it
+   * with `AllocPool::defer`.
+   */
+  class DeferredWork
+  {
+    /**
+     * Room for each of the components of the malloc shim that start from
+     * the environment.
+     */
+    static constexpr size_t SLOTS = 4;
+
+    inline static std::atomic<void (*)()> pending[SLOTS] = {};
+
+  public:
+    static void add(void (*f)())
+    {
+      for (auto& slot : pending)
+      {
+        void (*empty)() = nullptr;
+        if (slot.compare_exchange_strong(empty, f, std::memory_order_acq_rel))
+          return;
+      }
+      error("Too much deferred work");
+    }
+
+    static bool is_pending()
+    {
+      for (auto& slot : pending)
+      {
+        if (slot.load(std::memory_order_relaxed) != nullptr)
+          return true;
+      }
+      return false;
+    }
+
+    /**
+     * Run the pending work, if there is any.  Only one caller runs each
+     * piece of work.
+     */
+    static void run()
+    {
+      for (auto& slot : pending)
+      {
+        auto f = slot.exchange(nullptr, std::memory_order_acq_rel);
+        if (f != nullptr)
+          f();
+      }
+    }
+  };
+
   /**
    * Allocator.  This class is parameterised on five template parameters.
    *
@@ -109,12 +167,337 @@ namespace snmalloc
      */
     CapPtr<void, CBChunk> bump_ptrs[NUM_SMALL_CLASSES] = {nullptr};
 
+    /**
+     * Total bytes allocated and deallocated by this allocator, rounded up to
+     * the sizeclass.  Frees of remote objects are counted by the allocator
+     * that performs the free, not by the owner.  These only ever increase and
+     * are only written by the owning thread, so they can be read directly
+     * through the pointers returned by `allocated_bytes_ptr` and
+     * `deallocated_bytes_ptr`.
+     */
+    uint64_t bytes_allocated = 0;
+    uint64_t bytes_deallocated = 0;
+
+    /**
+     * The value of `bytes_allocated` after which the next allocation is
+     * sampled by the heap profiler.  Another thread may set this to zero to
+     * make the allocator choose a new sampling point.
+     */
+    std::atomic<uint64_t> sample_at{UINT64_MAX};
+
+    /**
+     * The tag that this allocator's allocations are attributed to.
+     */
+    alloc_tag_t alloc_tag = 0;
+
+    /**
+     * Bytes of small and medium objects freed by sending them to, or received
+     * as messages from, other allocators, and bytes of large allocations
+     * freed by this allocator, by the tag that allocated them.  Together with
+     * the totals above, these give the live bytes of each tag without any
+     * extra work on the local fast paths.
+     */
+    uint64_t remote_bytes_sent = 0;
+    uint64_t remote_bytes_received = 0;
+    uint64_t large_bytes_freed[NUM_ALLOC_TAGS] = {0};
+
+    /**
+     * The value of `remote_bytes_sent` when the remote cache was last
+     * posted.  The difference is the bytes still waiting in the cache.
+     */
+    uint64_t remote_bytes_posted = 0;
+
+    /**
+     * Deallocation slow paths taken since the remote cache was last posted.
+     */
+    size_t remote_cache_age = 0;
+
+    /**
+     * The capacity that the remote cache is adapting towards, before it is
+     * limited by its share of `REMOTE_CACHE_SHARED`.
+     */
+    int64_t remote_cache_target = REMOTE_CACHE;
+
+    /**
+     * The most messages to handle in one pass over the message queue.
+     */
+    size_t message_batch = REMOTE_BATCH;
+
+    /**
+     * The shard of the message queue to take the next message from.
+     */
+    size_t message_shard = 0;
+
   public:
     Stats& stats()
     {
       return large_allocator.stats;
     }
 
+    AllocCounters& counters()
+    {
+      return large_allocator.counters;
+    }
+
+    /**
+     * The slot that objects owned by this allocator are sent through in the
+     * remote caches of other allocators, which indexes
+     * `AllocCounters::remote_sent`.
+     */
+    size_t remote_slot()
+    {
+      return remote_cache.get_slot<Allocator>(get_trunc_id(), 0);
+    }
+
+    /**
+     * Pointers to the running totals of bytes allocated and deallocated by
+     * this allocator.  Reading the current value is a single load, so a
+     * caller can take the difference around a unit of work to attribute its
+     * allocation volume.
+     */
+    const uint64_t* allocated_bytes_ptr() const
+    {
+      return &bytes_allocated;
+    }
+
+    const uint64_t* deallocated_bytes_ptr() const
+    {
+      return &bytes_deallocated;
+    }
+
+    alloc_tag_t tag() const
+    {
+      return alloc_tag;
+    }
+
+    /**
+     * Set the tag of this allocator.  This must be done before it is first
+     * used, as objects it already owns would otherwise change tag.  The
+     * message queue stub, allocated on construction, is attributed to the
+     * new tag.
+     */
+    void set_tag(alloc_tag_t tag)
+    {
+      SNMALLOC_ASSERT(tag < NUM_ALLOC_TAGS);
+      alloc_tag = tag;
+    }
+
+    /**
+     * Add this allocator's contribution to the live bytes of each tag.  The
+     * small and medium objects that it owns count towards its own tag, and
+     * the large allocations that it has freed are subtracted from the tag
+     * that allocated them.  Objects freed by another thread remain live until
+     * this allocator processes the message that returns them.
+     *
+     * This can be called from any thread.  The result is not a consistent
+     * snapshot while allocators are in use.
+     */
+    void add_tag_bytes(int64_t (&live)[NUM_ALLOC_TAGS]) const
+    {
+      uint64_t large_freed = 0;
+      for (size_t i = 0; i < NUM_ALLOC_TAGS; i++)
+      {
+        large_freed += large_bytes_freed[i];
+        live[i] -= static_cast<int64_t>(large_bytes_freed[i]);
+      }
+
+      // The objects owned by this allocator that were freed locally, or
+      // returned to it by other allocators.
+      uint64_t owned_freed = bytes_deallocated - remote_bytes_sent -
+        large_freed + remote_bytes_received;
+      live[alloc_tag] += static_cast<int64_t>(bytes_allocated - owned_freed);
+    }
+
+    /**
+     * Add the bytes freed by this allocator that have not yet been returned
+     * to their owners: those still in its remote cache to `cached`, and those
+     * posted to other allocators' message queues, less those that have
+     * arrived in this allocator's queue, to `queued`.  Summed over every
+     * allocator, `queued` is the bytes in message queues, along with any
+     * being forwarded in remote caches.
+     *
+     * As with `add_tag_bytes`, this can be called from any thread.
+     */
+    void add_remote_bytes(int64_t& cached, int64_t& queued) const
+    {
+      cached += static_cast<int64_t>(remote_bytes_sent - remote_bytes_posted);
+      queued += static_cast<int64_t>(remote_bytes_posted) -
+        static_cast<int64_t>(remote_bytes_received);
+    }
+
+    /**
+     * Add the slabs of this allocator to `report`, beyond what
+     * `HeapReport::add_counters` finds from its counters.  This reads the
+     * allocator's thread-local state, so it must only be called by the
+     * thread that owns the allocator, or while no thread does.
+     */
+    void walk_heap(HeapReport& report)
+    {
+      // The placeholder allocator has nothing to walk.
+      if (NeedsInitialisation(this))
+        return;
+
+      report.walked_allocators++;
+
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        auto& sc = report.sizeclasses[i];
+
+        // Objects on the free lists of slabs that have free space.
+        size_t free = 0;
+        auto& sl = small_classes[i];
+        for (auto curr = sl.get_next(); address_cast(curr) != address_cast(&sl);
+             curr = curr->get_next())
+        {
+          free +=
+            curr.template as_static<Metaslab>()->free_queue.debug_length(
+              entropy);
+        }
+
+        // Iterate over a copy, so that the fast free list is unchanged.
+        size_t cached = 0;
+        FreeListIter fl = small_fast_free_lists[i];
+        for (; !fl.empty(); fl.take(entropy))
+          cached++;
+
+        address_t bp = address_cast(bump_ptrs[i]);
+        size_t reserve =
+          (address_align_up<SLAB_SIZE>(bp) - bp) / sizeclass_to_size(i);
+
+        size_t unused = free + cached + reserve;
+        size_t capacity = (counters().small_slabs_allocated[i] -
+                           counters().small_slabs_deallocated[i]) *
+          get_slab_capacity(i, false);
+        sc.live_objects += bits::max(capacity, unused) - unused;
+        sc.free_objects += free;
+        sc.cached_objects += cached;
+        sc.reserve_objects += reserve;
+      }
+
+      auto occupancy = [&report](CapPtr<Superslab, CBChunk> super) {
+        report.superslab_occupancy[super->slabs_in_use()]++;
+      };
+      super_available.for_each(occupancy);
+      super_only_short_available.for_each(occupancy);
+    }
+
+    /**
+     * Fill in `u` with how full the slab holding `p` is, and how full the
+     * slabs of its sizeclass in this allocator are.  Only objects owned by
+     * this allocator can be inspected.  Large allocations, and objects owned
+     * by other allocators, are reported as a full slab of one object, as
+     * jemalloc reports allocations that are not in a slab.
+     *
+     * Small slabs are counted at the capacity of a full-size slab in
+     * `bin_nregs`, and this walks the slabs of the sizeclass that have free
+     * space.  Slabs with no free space on their free lists, including the
+     * one the fast path is allocating from, are counted as full.
+     */
+    void utilization(const void* p, SlabUtilization& u)
+    {
+      bool next;
+      slab_utilization(p, u, next);
+    }
+
+    /**
+     * Returns true if moving the object at `p`, by allocating a copy from
+     * this allocator and freeing `p`, would help to empty sparsely used
+     * slabs: `p` is owned by this allocator and its slab is less full than
+     * the average for its sizeclass.  The slab that the next allocation of
+     * the sizeclass would come from is never hinted, so a copy allocated
+     * straight after the hint, by this thread, is never in the same slab.
+     */
+    bool defrag_hint(const void* p)
+    {
+      SlabUtilization u;
+      bool next;
+      slab_utilization(p, u, next);
+      if (next || (u.nfree == 0) || (u.bin_nregs == 0))
+        return false;
+
+      // (nregs - nfree) / nregs < (bin_nregs - bin_nfree) / bin_nregs
+      return (u.nregs - u.nfree) * u.bin_nregs <
+        (u.bin_nregs - u.bin_nfree) * u.nregs;
+    }
+
+    /**
+     * Implementation of `utilization`.  Also sets `next` if the next
+     * allocation of the sizeclass will come from the slab holding `p`.
+     */
+    void
+    slab_utilization(const void* p_raw, SlabUtilization& u, bool& next)
+    {
+      next = false;
+      u = {0, 1, alloc_size(p_raw), 0, 1};
+#ifndef SNMALLOC_PASS_THROUGH
+      auto p_ret = CapPtr<void, CBAllocE>(const_cast<void*>(p_raw));
+      uint8_t chunkmap_slab_kind = chunkmap().get(address_cast(p_ret));
+      auto p_auth = large_allocator.capptr_amplify(p_ret);
+
+      if (chunkmap_slab_kind == CMSuperslab)
+      {
+        auto super = Superslab::get(p_auth);
+        if (super->get_allocator() != public_state())
+          return;
+
+        auto slab = Metaslab::get_slab(p_auth);
+        auto meta = super->get_meta(slab);
+        sizeclass_t sizeclass = meta->sizeclass();
+        u.nregs = get_slab_capacity(sizeclass, Metaslab::is_short(slab));
+        u.nfree = meta->is_full() ? 0 : u.nregs - meta->needed();
+
+        // Allocation takes from the head of the list once the fast free
+        // list is empty.
+        auto& sl = small_classes[sizeclass];
+        next = !sl.is_empty() &&
+          (address_cast(sl.get_next()) == address_cast(meta));
+
+        u.bin_nfree = 0;
+        for (auto curr = sl.get_next(); address_cast(curr) != address_cast(&sl);
+             curr = curr->get_next())
+        {
+          auto m = curr.template as_static<Metaslab>();
+          bool is_short = Superslab::get(m)->is_short_meta(m);
+          u.bin_nfree += get_slab_capacity(sizeclass, is_short) - m->needed();
+        }
+        u.bin_nregs = (counters().small_slabs_allocated[sizeclass] -
+                       counters().small_slabs_deallocated[sizeclass]) *
+          get_slab_capacity(sizeclass, false);
+        u.bin_nregs = bits::max(u.bin_nregs, u.bin_nfree);
+        return;
+      }
+
+      if (chunkmap_slab_kind == CMMediumslab)
+      {
+        auto slab = Mediumslab::get(p_auth);
+        if (slab->get_allocator() != public_state())
+          return;
+
+        sizeclass_t sizeclass = slab->get_sizeclass();
+        sizeclass_t medium_class = sizeclass - NUM_SMALL_CLASSES;
+        u.nregs = medium_slab_free(sizeclass);
+        u.nfree = Mediumslab::free_count(slab);
+        next = address_cast(medium_classes[medium_class].get_head()) ==
+          address_cast(slab);
+
+        size_t live = counters().medium_allocated[medium_class] -
+          counters().medium_deallocated[medium_class];
+        u.bin_nregs = (counters().medium_slabs_allocated[medium_class] -
+                       counters().medium_slabs_deallocated[medium_class]) *
+          u.nregs;
+        u.bin_nfree = bits::max(u.bin_nregs, live) - live;
+      }
+#endif
+    }
+
+    /**
+     * The capacity the remote cache was given when it was last posted.
+     */
+    int64_t remote_cache_limit()
+    {
+      return remote_cache.limit;
+    }
+
     template<class MP, class Alloc>
     friend class AllocPool;
 
@@ -139,21 +522,23 @@ namespace snmalloc
 
       stats().alloc_request(size);
 
+      CapPtr<void, CBAllocE> p;
       if constexpr (sizeclass < NUM_SMALL_CLASSES)
       {
-        return capptr_reveal(small_alloc<zero_mem>(size));
+        p = small_alloc<zero_mem>(size);
       }
       else if constexpr (sizeclass < NUM_SIZECLASSES)
       {
         handle_message_queue();
         constexpr size_t rsize = sizeclass_to_size(sizeclass);
-        return capptr_reveal(medium_alloc<zero_mem>(sizeclass, rsize, size));
+        p = medium_alloc<zero_mem>(sizeclass, rsize, size);
       }
       else
       {
         handle_message_queue();
-        return capptr_reveal(large_alloc<zero_mem>(size));
+        p = large_alloc<zero_mem>(size);
       }
+      return check_sample(capptr_reveal(p), size);
 #endif
     }
 
@@ -175,14 +560,19 @@ namespace snmalloc
 #else
       // Perform the - 1 on size, so that zero wraps around and ends up on
       // slow path.
+      CapPtr<void, CBAllocE> p;
       if (likely((size - 1) <= (sizeclass_to_size(NUM_SMALL_CLASSES - 1) - 1)))
       {
         // Allocations smaller than the slab size are more likely. Improve
         // branch prediction by placing this case first.
-        return capptr_reveal(small_alloc<zero_mem>(size));
+        p = small_alloc<zero_mem>(size);
+      }
+      else
+      {
+        p = alloc_not_small<zero_mem>(size);
       }
 
-      return capptr_reveal(alloc_not_small<zero_mem>(size));
+      return check_sample(capptr_reveal(p), size);
     }
 
     template<ZeroMem zero_mem = NoZero>
@@ -206,6 +596,37 @@ namespace snmalloc
 #endif
     }
 
+    /**
+     * Allocate memory of a dynamically known size, in the style of C++23's
+     * `allocate_at_least`.  Returns the allocation and the number of bytes
+     * that are usable from it, which is at least `size`.  The caller may
+     * later free the allocation with `dealloc(p, n)` for any `n` between
+     * `size` and the returned usable size.
+     */
+    template<ZeroMem zero_mem = NoZero>
+    SNMALLOC_FAST_PATH ALLOCATOR std::pair<void*, size_t>
+    alloc_at_least(size_t size)
+    {
+      void* p = alloc<zero_mem>(size);
+      if (p == nullptr)
+        return {nullptr, 0};
+#ifdef SNMALLOC_PASS_THROUGH
+      return {p, external_alloc::malloc_usable_size(p)};
+#else
+      return {p, round_size(size)};
+#endif
+    }
+
+    /**
+     * Ask this allocator to choose a new heap profiler sampling point, after
+     * profiling has been started or stopped.  This can be called from any
+     * thread.
+     */
+    void reschedule_sample()
+    {
+      sample_at.store(0, std::memory_order_relaxed);
+    }
+
     /*
      * Free memory of a statically known size. Must be called with an
      * external pointer.
@@ -219,6 +640,8 @@ namespace snmalloc
 #else
       constexpr sizeclass_t sizeclass = size_to_sizeclass_const(size);
 
+      HeapProfile::on_dealloc(p_raw);
+
       auto p_ret = large_allocator.capptr_dewild(capptr_from_client(p_raw));
       auto p_auth = large_allocator.capptr_amplify(p_ret);
 
@@ -253,6 +676,8 @@ namespace snmalloc
 #else
       SNMALLOC_ASSERT(p_raw != nullptr);
 
+      HeapProfile::on_dealloc(p_raw);
+
       auto p_ret = large_allocator.capptr_dewild(capptr_from_client(p_raw));
       auto p_auth = large_allocator.capptr_amplify(p_ret);
 
@@ -276,11 +701,13 @@ namespace snmalloc
 
       if (likely(size <= sizeclass_to_size(NUM_SIZECLASSES - 1)))
       {
+        handle_message_queue();
         auto slab = Mediumslab::get(p_auth);
         sizeclass_t sizeclass = size_to_sizeclass(size);
         medium_dealloc_unchecked(slab, p_auth, p_ret, sizeclass);
         return;
       }
+      handle_remote_staleness();
       large_dealloc_unchecked(p_auth, p_ret, size);
     }
 
@@ -293,6 +720,7 @@ namespace snmalloc
 #ifdef SNMALLOC_PASS_THROUGH
       return external_alloc::free(p_raw);
 #else
+      HeapProfile::on_dealloc(p_raw);
 
       auto p_ret = large_allocator.capptr_dewild(capptr_from_client(p_raw));
       uint8_t chunkmap_slab_kind = chunkmap().get(address_cast(p_ret));
@@ -330,13 +758,13 @@ namespace snmalloc
       CapPtr<void, CBAllocE> p_ret,
       uint8_t chunkmap_slab_kind)
     {
-      handle_message_queue();
-
       if (p_ret == nullptr)
         return;
 
       if (chunkmap_slab_kind == CMMediumslab)
       {
+        handle_message_queue();
+
         /*
          * The same reasoning from the fast path continues to hold here.  These
          * values are suspect until we complete the double-free check in
@@ -354,6 +782,7 @@ namespace snmalloc
         error("Not allocated by this allocator");
       }
 
+      handle_remote_staleness();
       large_dealloc_checked_sizeclass(
         p_auth,
         p_ret,
@@ -519,12 +948,77 @@ namespace snmalloc
   private:
     using alloc_id_t = typename Remote::alloc_id_t;
 
+    /**
+     * Choose the point at which the heap profiler next samples an
+     * allocation.
+     */
+    void schedule_sample()
+    {
+      if (DeferredWork::is_pending())
+      {
+        sample_at.store(0, std::memory_order_relaxed);
+        return;
+      }
+
+      uint64_t distance = HeapProfile::next_sample(entropy.get_next());
+      sample_at.store(
+        (distance > UINT64_MAX - bytes_allocated) ? UINT64_MAX :
+                                                    bytes_allocated + distance,
+        std::memory_order_relaxed);
+    }
+
+    /**
+     * Pass an allocation to the heap profiler if it is due to be sampled.
+     * This is false for the placeholder allocator, whose fields are all zero.
+     */
+    SNMALLOC_FAST_PATH void* check_sample(void* p, size_t size)
+    {
+      if (unlikely(bytes_allocated > sample_at.load(std::memory_order_relaxed)))
+        return sample(p, size);
+      return p;
+    }
+
+    SNMALLOC_SLOW_PATH void* sample(void* p, size_t size)
+    {
+      // A sampling point of zero is a request to reschedule, and not a
+      // sample.
+      bool reschedule = sample_at.load(std::memory_order_relaxed) == 0;
+
+      // Schedule the next sample first, so that allocations made while
+      // recording this one are not sampled.
+      schedule_sample();
+
+      if (!reschedule && HeapProfile::is_active())
+        HeapProfile::record(p, round_size(bits::max<size_t>(size, 1)));
+
+      // The allocation is complete, so the allocator can be reentered.
+      if (reschedule)
+        DeferredWork::run();
+      return p;
+    }
+
     SlabList small_classes[NUM_SMALL_CLASSES];
     DLList<Mediumslab, CapPtrCBChunkE> medium_classes[NUM_MEDIUM_CLASSES];
 
     DLList<Superslab, CapPtrCBChunk> super_available;
     DLList<Superslab, CapPtrCBChunk> super_only_short_available;
 
+    /**
+     * Called when this allocator needs a new superslab, to adopt instead the
+     * partially used superslabs of an allocator that no thread owns.  These
+     * are set by the `AllocPool` that hands out this allocator, and are null
+     * for the placeholder and for allocators outside a pool.
+     */
+    bool (*adopt_released)(void* pool, Allocator* self) = nullptr;
+    void* adopt_pool = nullptr;
+
+    /**
+     * Set while this allocator is in its pool with partially used slabs that
+     * another allocator could adopt.  Only the thread that holds the
+     * allocator, or has taken it out of the pool, reads or writes this.
+     */
+    bool is_donor = false;
+
     RemoteCache remote_cache;
 
     std::conditional_t<IsQueueInline, RemoteAllocator, RemoteAllocator*>
@@ -542,9 +1036,9 @@ namespace snmalloc
       }
     }
 
-    auto& message_queue()
+    auto& message_queue(size_t shard)
     {
-      return public_state()->message_queue;
+      return public_state()->message_queue(shard);
     }
 
     template<class A, class MemProvider>
@@ -579,7 +1073,13 @@ namespace snmalloc
       entropy.init<typename MemoryProvider::Pal>();
 
       init_message_queue();
-      message_queue().invariant();
+      for (size_t i = 0; i < REMOTE_QUEUE_SHARDS; i++)
+        message_queue(i).invariant();
+
+      // Start with an empty remote cache.
+      remote_cache.capacity = remote_cache.limit;
+
+      schedule_sample();
 
 #ifndef NDEBUG
       for (sizeclass_t i = 0; i < NUM_SIZECLASSES; i++)
@@ -617,56 +1117,30 @@ namespace snmalloc
         }
       };
 
-      // Destroy the message queue so that it has no stub message.
+      // Destroy the message queues so that they have no stub messages.
+      for (size_t i = 0; i < REMOTE_QUEUE_SHARDS; i++)
       {
-        CapPtr<Remote, CBAlloc> p = message_queue().destroy();
+        CapPtr<Remote, CBAlloc> p = message_queue(i).destroy();
 
         while (p != nullptr)
         {
           auto n = p->non_atomic_next;
+          if (n != nullptr)
+            count_received(n);
           handle_dealloc_remote(p);
           p = n;
         }
       }
 
       // Dump bump allocators back into memory
-      for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
-      {
-        auto& bp = bump_ptrs[i];
-        auto rsize = sizeclass_to_size(i);
-        FreeListIter ffl;
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+        return_bump_ptr(i);
 
-        CapPtr<Superslab, CBChunk> super = Superslab::get(bp);
-        auto super_slabd = capptr_debug_chunkd_from_chunk(super);
-
-        CapPtr<Slab, CBChunk> slab = Metaslab::get_slab(bp);
-        auto slab_slabd = capptr_debug_chunkd_from_chunk(slab);
-
-        while (pointer_align_up(bp, SLAB_SIZE) != bp)
-        {
-          Slab::alloc_new_list(bp, ffl, rsize, entropy);
-          while (!ffl.empty())
-          {
-            small_dealloc_offseted_inner(
-              super_slabd, slab_slabd, ffl.take(entropy), i);
-          }
-        }
-      }
-
-      for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
       {
         if (!small_fast_free_lists[i].empty())
         {
-          auto head = small_fast_free_lists[i].peek();
-          auto head_auth = large_allocator.capptr_amplify(head);
-          auto super = Superslab::get(head_auth);
-          auto slab = Metaslab::get_slab(head_auth);
-          do
-          {
-            auto curr = small_fast_free_lists[i].take(entropy);
-            small_dealloc_offseted_inner(super, slab, curr, i);
-          } while (!small_fast_free_lists[i].empty());
-
+          return_free_list(small_fast_free_lists[i], i);
           test(small_classes[i]);
         }
       }
@@ -683,6 +1157,78 @@ namespace snmalloc
       init_message_queue();
     }
 
+    /**
+     * Process any deallocations that other threads have sent to this
+     * allocator, and send every deallocation cached for other allocators to
+     * its owner.  Afterwards this allocator holds no memory belonging to
+     * anyone else.
+     */
+    SNMALLOC_SLOW_PATH void flush()
+    {
+      // The placeholder allocator has nothing to flush.
+      if (NeedsInitialisation(this))
+        return;
+
+      handle_message_queue();
+
+      if (!remote_cache.is_empty())
+        post_remote_cache();
+    }
+
+    /**
+     * Return as much memory as possible from an allocator that no thread is
+     * using: process the whole message queue, return the objects on the fast
+     * free lists and in the bump allocators to their slabs, so that slabs
+     * and superslabs that become empty are freed, and post the remote cache.
+     * Partially used slabs stay with this allocator, for whichever thread
+     * next acquires it or for another allocator to `adopt`.  The owning
+     * thread can also call this, at the cost of refilling its free lists on
+     * later allocations.
+     */
+    SNMALLOC_SLOW_PATH void reclaim()
+    {
+      // The placeholder allocator has nothing to reclaim.
+      if (NeedsInitialisation(this))
+        return;
+
+      // Take every message that has arrived, but do not wait for a sender
+      // that is part way through an enqueue: its messages look like an empty
+      // queue until it finishes, and are left for the next owner or the
+      // next `cleanup_unused`.
+      while (handle_message_queue_inner())
+      {
+      }
+
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        return_bump_ptr(i);
+        return_free_list(small_fast_free_lists[i], i);
+      }
+
+      if (!remote_cache.is_empty())
+        post_remote_cache();
+    }
+
+    /**
+     * Reclaim the memory that this allocator holds but is not using, as
+     * `reclaim` does, and then decommit the chunks cached in the large
+     * stacks, which include any superslabs just freed.  Returns the bytes
+     * decommitted.  `AllocPool::trim` also reclaims the memory of the
+     * allocators that no thread is using.
+     */
+    size_t trim()
+    {
+      // The placeholder allocator holds nothing, and has no memory provider.
+      if (NeedsInitialisation(this))
+        return 0;
+
+      auto& mp = large_allocator.memory_provider;
+      size_t decommitted = mp.total_decommitted();
+      reclaim();
+      mp.purge();
+      return mp.total_decommitted() - decommitted;
+    }
+
     template<Boundary location>
     static CapPtr<void, CBAllocE> external_pointer(
       CapPtr<void, CBAllocE> p_ret,
@@ -706,37 +1252,188 @@ namespace snmalloc
         end_point_correction, -static_cast<ptrdiff_t>(end_to_end));
     }
 
+    /**
+     * Return every object on `fl`, which are all in one slab, to the slab.
+     */
+    void return_free_list(FreeListIter& fl, sizeclass_t sizeclass)
+    {
+      if (fl.empty())
+        return;
+
+      auto head_auth = large_allocator.capptr_amplify(fl.peek());
+      auto super = Superslab::get(head_auth);
+      auto slab = Metaslab::get_slab(head_auth);
+      do
+      {
+        small_dealloc_offseted_inner(super, slab, fl.take(entropy), sizeclass);
+      } while (!fl.empty());
+    }
+
+    /**
+     * Return the objects that have not been carved from the bump allocator
+     * for `sizeclass` to their slab.
+     */
+    void return_bump_ptr(sizeclass_t sizeclass)
+    {
+      auto& bp = bump_ptrs[sizeclass];
+      auto rsize = sizeclass_to_size(sizeclass);
+
+      while (pointer_align_up(bp, SLAB_SIZE) != bp)
+      {
+        FreeListIter ffl;
+        Slab::alloc_new_list(bp, ffl, rsize, entropy);
+        return_free_list(ffl, sizeclass);
+      }
+    }
+
     void init_message_queue()
     {
-      // Manufacture an allocation to prime the queue
-      // Using an actual allocation removes a conditional from a critical path.
-      auto dummy = CapPtr<void, CBAlloc>(alloc<YesZero>(MIN_ALLOC_SIZE))
-                     .template as_static<Remote>();
-      if (dummy == nullptr)
+      // Adopted slabs could be sent messages before every queue is ready.
+      auto adopt = adopt_released;
+      adopt_released = nullptr;
+      for (size_t i = 0; i < REMOTE_QUEUE_SHARDS; i++)
       {
-        error("Critical error: Out-of-memory during initialisation.");
+        // Manufacture an allocation to prime the queue
+        // Using an actual allocation removes a conditional from a critical
+        // path.
+        auto dummy = CapPtr<void, CBAlloc>(alloc<YesZero>(MIN_ALLOC_SIZE))
+                       .template as_static<Remote>();
+        if (dummy == nullptr)
+        {
+          error("Critical error: Out-of-memory during initialisation.");
+        }
+        dummy->set_info(
+          get_trunc_id(), size_to_sizeclass_const(MIN_ALLOC_SIZE));
+        count_received(dummy);
+        message_queue(i).init(dummy);
       }
-      dummy->set_info(get_trunc_id(), size_to_sizeclass_const(MIN_ALLOC_SIZE));
-      message_queue().init(dummy);
+      adopt_released = adopt;
+    }
+
+    /**
+     * Count a message as returned to this allocator, if it is for this
+     * allocator.  The message at the front of the queue stays there as the
+     * stub until the next message arrives, so a message is counted when it
+     * reaches the front rather than when it is processed.
+     */
+    void count_received(CapPtr<Remote, CBAlloc> r)
+    {
+      if (Remote::trunc_target_id(r, &large_allocator) == get_trunc_id())
+        remote_bytes_received += sizeclass_to_size(r->sizeclass());
     }
 
     SNMALLOC_FAST_PATH void handle_dealloc_remote(CapPtr<Remote, CBAlloc> p)
     {
-      auto target_id = Remote::trunc_target_id(p, &large_allocator);
-      if (likely(target_id == get_trunc_id()))
+      // Route by the slab's current owner rather than the id cached in the
+      // message, as the slab may have been adopted since the message was
+      // sent.
+      auto p_auth = large_allocator.template capptr_amplify<Remote>(p);
+      auto super = Superslab::get(p_auth);
+      RemoteAllocator* target = super->get_allocator();
+      if (likely(target == public_state()))
       {
         // Destined for my slabs
-        auto p_auth = large_allocator.template capptr_amplify<Remote>(p);
-        auto super = Superslab::get(p_auth);
         auto sizeclass = p->sizeclass();
         dealloc_not_large_local(super, Remote::clear(p), sizeclass);
       }
       else
       {
         // Merely routing; despite the cast here, p is going to be cast right
-        // back to a Remote.
+        // back to a Remote.  A message that was sent here before its slab
+        // was adopted was counted as received, so count it as sent again.
+        counters().remote_forwarded += 1;
+        if (Remote::trunc_target_id(p, &large_allocator) == get_trunc_id())
+          remote_bytes_sent += sizeclass_to_size(p->sizeclass());
         remote_cache.dealloc<Allocator>(
-          target_id, p.template as_reinterpret<void>(), p->sizeclass());
+          target->trunc_id(),
+          p.template as_reinterpret<void>(),
+          p->sizeclass());
+      }
+    }
+
+    /**
+     * Handle `n` messages taken from the message queue in address order, so
+     * that objects in the same slab are handled together: the slab's
+     * metadata is found once for each run of objects, and its count of
+     * objects needed to free it is updated once if none of them frees it.
+     */
+    void handle_dealloc_remote_sorted(CapPtr<Remote, CBAlloc>* batch, size_t n)
+    {
+      // Insertion sort, as batches are small and often nearly sorted.
+      for (size_t i = 1; i < n; i++)
+      {
+        auto r = batch[i];
+        size_t j = i;
+        for (; (j > 0) && (r < batch[j - 1]); j--)
+          batch[j] = batch[j - 1];
+        batch[j] = r;
+      }
+
+      size_t i = 0;
+      while (i < n)
+      {
+        auto p = batch[i];
+        sizeclass_t sizeclass = p->sizeclass();
+        auto p_auth = large_allocator.template capptr_amplify<Remote>(p);
+        auto super = Superslab::get(p_auth);
+        if (
+          (sizeclass >= NUM_SMALL_CLASSES) ||
+          (super->get_allocator() != public_state()))
+        {
+          handle_dealloc_remote(p);
+          i++;
+          continue;
+        }
+
+        // Objects in the same slab have the same owner and sizeclass.
+        address_t slab_start = address_align_down<SLAB_SIZE>(address_cast(p));
+        size_t end = i + 1;
+        while ((end < n) &&
+               (address_align_down<SLAB_SIZE>(address_cast(batch[end])) ==
+                slab_start))
+          end++;
+
+        if (end < n)
+        {
+          auto next = large_allocator.template capptr_amplify<Remote>(
+            batch[end]);
+          Aal::prefetch(Superslab::get(next)
+                          ->get_meta(Metaslab::get_slab(next))
+                          .unsafe_capptr);
+        }
+
+        check_client(
+          super->get_kind() == Super,
+          "Heap Corruption: Sizeclass of remote dealloc corrupt.");
+        auto slab = Metaslab::get_slab(Aal::capptr_rebound(super.as_void(), p));
+        auto meta = super->get_meta(slab);
+        check_client(
+          meta->sizeclass() == sizeclass,
+          "Heap Corruption: Sizeclass of remote dealloc corrupt.");
+
+        if (likely(meta->return_objects(static_cast<uint16_t>(end - i))))
+        {
+          for (; i < end; i++)
+          {
+            check_client(
+              batch[i]->sizeclass() == sizeclass,
+              "Heap Corruption: Sizeclass of remote dealloc corrupt.");
+            stats().sizeclass_dealloc(sizeclass);
+            meta->free_queue.add(
+              FreeObject::make(Remote::clear(batch[i])), entropy);
+          }
+        }
+        else
+        {
+          for (; i < end; i++)
+          {
+            check_client(
+              batch[i]->sizeclass() == sizeclass,
+              "Heap Corruption: Sizeclass of remote dealloc corrupt.");
+            small_dealloc_offseted(
+              super, slab, Remote::clear(batch[i]), sizeclass);
+          }
+        }
       }
     }
 
@@ -747,6 +1444,7 @@ namespace snmalloc
       {
         auto p_auth = large_allocator.capptr_amplify(p);
         auto super = Superslab::get(p_auth);
+        bytes_deallocated += sizeclass_to_size(sizeclass);
         dealloc_not_large_local(super, p, sizeclass);
       }
       else
@@ -791,24 +1489,58 @@ namespace snmalloc
       }
     }
 
-    SNMALLOC_SLOW_PATH void handle_message_queue_inner()
+    /**
+     * Process a batch of messages, taking from the shards in turn.  Returns
+     * true if it stopped at the batch limit, so more messages may be
+     * waiting, and false if it found every shard empty.
+     */
+    SNMALLOC_SLOW_PATH bool handle_message_queue_inner()
     {
-      for (size_t i = 0; i < REMOTE_BATCH; i++)
+      LatencyTimer timer(counters().latency[SlowMessageQueue]);
+      CapPtr<Remote, CBAlloc> sorted[REMOTE_SORT_BATCH];
+      size_t n = 0;
+      size_t i = 0;
+      size_t empty_shards = 0;
+      while ((i < message_batch) && (empty_shards < REMOTE_QUEUE_SHARDS))
       {
-        auto r = message_queue().dequeue();
+        // Take from each shard in turn, so that no sender's messages wait
+        // behind those of busier senders.
+        auto r = message_queue(message_shard).dequeue();
+        message_shard = (message_shard + 1) % REMOTE_QUEUE_SHARDS;
 
         if (unlikely(!r.second))
-          break;
+        {
+          empty_shards++;
+          continue;
+        }
 
-        handle_dealloc_remote(r.first);
+        empty_shards = 0;
+        i++;
+        count_received(r.first->next.load(std::memory_order_relaxed));
+        sorted[n++] = r.first;
+        if (n == REMOTE_SORT_BATCH)
+        {
+          handle_dealloc_remote_sorted(sorted, n);
+          n = 0;
+        }
       }
+      handle_dealloc_remote_sorted(sorted, n);
+      counters().remote_received += i;
+      SNMALLOC_TRACEPOINT(
+        message_queue, i, static_cast<size_t>(counters().remote_received));
+
+      // Catch up sooner with a queue that stays busy.
+      bool full = (i == message_batch);
+      if (full)
+        message_batch = bits::min(message_batch * 2, REMOTE_BATCH_MAX);
+      else
+        message_batch = REMOTE_BATCH;
 
       // Our remote queues may be larger due to forwarding remote frees.
-      if (likely(remote_cache.capacity > 0))
-        return;
+      if (unlikely(remote_cache.capacity <= 0))
+        post_remote_cache();
 
-      stats().remote_post();
-      remote_cache.post<Allocator>(this, get_trunc_id());
+      return full;
     }
 
     /**
@@ -817,7 +1549,12 @@ namespace snmalloc
      */
     SNMALLOC_FAST_PATH bool has_messages()
     {
-      return !(message_queue().is_empty());
+      for (size_t i = 0; i < REMOTE_QUEUE_SHARDS; i++)
+      {
+        if (!message_queue(i).is_empty())
+          return true;
+      }
+      return false;
     }
 
     SNMALLOC_FAST_PATH void handle_message_queue()
@@ -836,6 +1573,15 @@ namespace snmalloc
       if (super != nullptr)
         return super;
 
+      // Prefer the partially used superslabs of a released allocator to
+      // reserving a new one.
+      if ((adopt_released != nullptr) && adopt_released(adopt_pool, this))
+      {
+        super = super_available.get_head();
+        if (super != nullptr)
+          return super;
+      }
+
       super = large_allocator
                 .template alloc<NoZero>(0, SUPERSLAB_SIZE, SUPERSLAB_SIZE)
                 .template as_reinterpret<Superslab>();
@@ -843,12 +1589,109 @@ namespace snmalloc
       if (super == nullptr)
         return super;
 
+      SNMALLOC_TRACEPOINT(get_superslab, super.unsafe_capptr, SUPERSLAB_SIZE);
       super->init(public_state());
       chunkmap().set_slab(super);
       super_available.insert(super);
       return super;
     }
 
+    /**
+     * Returns true if this allocator has partially used slabs or superslabs
+     * that `adopt` would take.
+     */
+    bool has_adoptable()
+    {
+      if (!super_available.is_empty() || !super_only_short_available.is_empty())
+        return true;
+
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        if (!small_classes[i].is_empty())
+          return true;
+      }
+      return false;
+    }
+
+    /**
+     * Take over the partially used slabs and superslabs of `donor`, an
+     * allocator that no thread owns and that has been reclaimed.  Each
+     * superslab that holds one of them changes owner, along with all of its
+     * slabs.  Superslabs whose slabs are all full, and medium slabs, stay
+     * with the donor.  Messages already sent to the donor for the adopted
+     * superslabs are forwarded here when the donor next handles its queue.
+     */
+    void adopt(Allocator* donor)
+    {
+      CapPtr<Superslab, CBChunk> super;
+      while ((super = donor->super_available.pop()) != nullptr)
+      {
+        adopt_superslab(donor, super);
+        super_available.insert(super);
+      }
+      while ((super = donor->super_only_short_available.pop()) != nullptr)
+      {
+        adopt_superslab(donor, super);
+        super_only_short_available.insert(super);
+      }
+
+      // The remaining superslabs with partially used slabs are full.
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        auto& from = donor->small_classes[i];
+        while (!from.is_empty())
+        {
+          auto link = from.get_next();
+          auto meta = link.template as_static<Metaslab>();
+          auto owner = Superslab::get(meta);
+          if (owner->get_allocator() != public_state())
+            adopt_superslab(donor, owner);
+          link->remove();
+          small_classes[i].insert_prev(link);
+        }
+      }
+    }
+
+    /**
+     * Make this allocator the owner of `super` and its slabs, which `donor`
+     * owned.  The slabs' free queues are encoded with the owner's key, so
+     * they are rebuilt with this allocator's.
+     */
+    void adopt_superslab(Allocator* donor, CapPtr<Superslab, CBChunk> super)
+    {
+      super->set_allocator(public_state());
+
+      for (size_t i = 0; i < SLAB_COUNT; i++)
+      {
+        auto slab =
+          pointer_offset(super, i << SLAB_BITS).template as_static<Slab>();
+        auto meta = super->get_meta(slab);
+        if (meta->is_unused())
+          continue;
+
+        sizeclass_t sizeclass = meta->sizeclass();
+        bool is_short = (i == 0);
+        size_t capacity = get_slab_capacity(sizeclass, is_short);
+        size_t live = meta->needed();
+        if (meta->is_full())
+          live += capacity - meta->threshold_for_waking_slab(is_short);
+        stats().sizeclass_adopt_slab(donor->stats(), sizeclass, live);
+        donor->counters().small_slabs_deallocated[sizeclass] += 1;
+        counters().small_slabs_allocated[sizeclass] += 1;
+
+#ifdef CHECK_CLIENT
+        if (!meta->free_queue.empty())
+        {
+          FreeListIter fl;
+          meta->free_queue.close(fl, donor->entropy);
+          meta->free_queue.open(slab.as_void());
+          while (!fl.empty())
+            meta->free_queue.add(fl.take(donor->entropy), entropy);
+        }
+#endif
+      }
+    }
+
     void reposition_superslab(CapPtr<Superslab, CBChunk> super)
     {
       switch (super->get_status())
@@ -885,7 +1728,11 @@ namespace snmalloc
 
     SNMALLOC_SLOW_PATH CapPtr<Slab, CBChunk> alloc_slab(sizeclass_t sizeclass)
     {
+      LatencyTimer timer(counters().latency[SlowAllocSlab]);
       stats().sizeclass_alloc_slab(sizeclass);
+      counters().small_slabs_allocated[sizeclass] += 1;
+      SNMALLOC_TRACEPOINT(
+        alloc_slab, sizeclass, sizeclass_to_size(sizeclass), SLAB_SIZE);
       if (Superslab::is_short_sizeclass(sizeclass))
       {
         // Pull a short slab from the list of superslabs that have only the
@@ -937,6 +1784,7 @@ namespace snmalloc
       {
         stats().alloc_request(size);
         stats().sizeclass_alloc(sizeclass);
+        bytes_allocated += sizeclass_to_size(sizeclass);
         auto p = fl.take(entropy);
         if constexpr (zero_mem == YesZero)
         {
@@ -981,11 +1829,19 @@ namespace snmalloc
       {
         stats().alloc_request(size);
         stats().sizeclass_alloc(sizeclass);
+        bytes_allocated += rsize;
 
         auto meta = sl.get_next().template as_static<Metaslab>();
         auto& ffl = small_fast_free_lists[sizeclass];
-        return Metaslab::alloc<zero_mem, typename MemoryProvider::Pal>(
+        uint16_t in_use = meta->needed();
+        auto p = Metaslab::alloc<zero_mem, typename MemoryProvider::Pal>(
           meta, ffl, rsize, entropy);
+        // Everything that was on the slab's free list is now available to
+        // the fast path.
+        auto slab = Metaslab::get_slab(Aal::capptr_rebound(meta.as_void(), p));
+        counters().small_refilled[sizeclass] +=
+          get_slab_capacity(sizeclass, Metaslab::is_short(slab)) - in_use;
+        return p;
       }
       return small_alloc_rare<zero_mem>(sizeclass, size);
     }
@@ -1001,8 +1857,10 @@ namespace snmalloc
     {
       if (likely(!NeedsInitialisation(this)))
       {
+        LatencyTimer timer(counters().latency[SlowSmallAllocRare]);
         stats().alloc_request(size);
         stats().sizeclass_alloc(sizeclass);
+        bytes_allocated += sizeclass_to_size(sizeclass);
         return small_alloc_new_free_list<zero_mem>(sizeclass);
       }
       return small_alloc_first_alloc<zero_mem>(sizeclass, size);
@@ -1023,10 +1881,12 @@ namespace snmalloc
        * pointer before we just go slapping that label on a void* later.
        */
       void* ret = InitThreadAllocator([sizeclass, size](void* alloc) {
+        auto* a = reinterpret_cast<Allocator*>(alloc);
         CapPtr<void, CBAllocE> ret =
-          reinterpret_cast<Allocator*>(alloc)
-            ->template small_alloc_inner<zero_mem>(sizeclass, size);
-        return ret.unsafe_capptr;
+          a->template small_alloc_inner<zero_mem>(sizeclass, size);
+        // The caller checks for a sample on the placeholder, which never
+        // samples, so check on the new allocator here.
+        return a->check_sample(capptr_reveal(ret), size);
       });
       return CapPtr<void, CBAllocE>(ret);
     }
@@ -1060,7 +1920,9 @@ namespace snmalloc
       auto rsize = sizeclass_to_size(sizeclass);
       auto& ffl = small_fast_free_lists[sizeclass];
       SNMALLOC_ASSERT(ffl.empty());
+      auto start = bp;
       Slab::alloc_new_list(bp, ffl, rsize, entropy);
+      counters().small_refilled[sizeclass] += pointer_diff(start, bp) / rsize;
 
       auto p = ffl.take(entropy);
 
@@ -1151,12 +2013,35 @@ namespace snmalloc
 
       if (likely(target == public_state()))
       {
-        small_dealloc_offseted(super, slab, p, sizeclass);
+        bytes_deallocated += sizeclass_to_size(sizeclass);
+        stats().sizeclass_dealloc(sizeclass);
+
+        auto f = FreeObject::make(p);
+        if (likely(Slab::dealloc_fast(slab, super, f, entropy)))
+          return;
+
+        small_dealloc_local_slow(super, slab, f, sizeclass);
       }
       else
         remote_dealloc(target, p, sizeclass);
     }
 
+    /**
+     * The slow path of a small deallocation by this allocator's thread.
+     * Deallocations taken from the message queue use
+     * `small_dealloc_offseted_slow` directly, as processing the queue again
+     * from there would recurse.
+     */
+    SNMALLOC_SLOW_PATH void small_dealloc_local_slow(
+      CapPtr<Superslab, CBChunkD> super,
+      CapPtr<Slab, CBChunkD> slab,
+      CapPtr<FreeObject, CBAlloc> p,
+      sizeclass_t sizeclass)
+    {
+      small_dealloc_offseted_slow(super, slab, p, sizeclass);
+      handle_remote_staleness();
+    }
+
     SNMALLOC_FAST_PATH void small_dealloc_offseted(
       CapPtr<Superslab, CBChunkD> super,
       CapPtr<Slab, CBChunkD> slab,
@@ -1192,6 +2077,7 @@ namespace snmalloc
       if (likely(a == Superslab::NoSlabReturn))
         return;
       stats().sizeclass_dealloc_slab(sizeclass);
+      counters().small_slabs_deallocated[sizeclass] += 1;
 
       if (a == Superslab::NoStatusChange)
         return;
@@ -1269,24 +2155,29 @@ namespace snmalloc
            */
           void* ret =
             InitThreadAllocator([size, rsize, sizeclass](void* alloc) {
+              auto* a = reinterpret_cast<Allocator*>(alloc);
               CapPtr<void, CBAllocE> ret =
-                reinterpret_cast<Allocator*>(alloc)->medium_alloc<zero_mem>(
-                  sizeclass, rsize, size);
-              return ret.unsafe_capptr;
+                a->template medium_alloc<zero_mem>(sizeclass, rsize, size);
+              return a->check_sample(capptr_reveal(ret), size);
             });
           return CapPtr<void, CBAllocE>(ret);
         }
 
-        auto newslab =
-          large_allocator
-            .template alloc<NoZero>(0, SUPERSLAB_SIZE, SUPERSLAB_SIZE)
-            .template as_reinterpret<Mediumslab>();
+        CapPtr<Mediumslab, CBChunk> newslab;
+        {
+          LatencyTimer timer(counters().latency[SlowMediumSlab]);
+          newslab =
+            large_allocator
+              .template alloc<NoZero>(0, SUPERSLAB_SIZE, SUPERSLAB_SIZE)
+              .template as_reinterpret<Mediumslab>();
 
-        if (newslab == nullptr)
-          return nullptr;
+          if (newslab == nullptr)
+            return nullptr;
 
-        Mediumslab::init(newslab, public_state(), sizeclass, rsize);
-        chunkmap().set_slab(newslab);
+          Mediumslab::init(newslab, public_state(), sizeclass, rsize);
+          chunkmap().set_slab(newslab);
+        }
+        counters().medium_slabs_allocated[medium_class] += 1;
 
         auto newslab_export = capptr_export(newslab);
 
@@ -1299,6 +2190,8 @@ namespace snmalloc
 
       stats().alloc_request(size);
       stats().sizeclass_alloc(sizeclass);
+      counters().medium_allocated[sizeclass - NUM_SMALL_CLASSES] += 1;
+      bytes_allocated += rsize;
 
       return p;
     }
@@ -1364,7 +2257,10 @@ namespace snmalloc
         Aal::capptr_bound<void, CBAlloc>(p_auth, sizeclass_to_size(sizeclass));
 
       if (likely(target == public_state()))
+      {
+        bytes_deallocated += sizeclass_to_size(sizeclass);
         medium_dealloc_local(slab, p, sizeclass);
+      }
       else
       {
         remote_dealloc(target, p, sizeclass);
@@ -1378,12 +2274,15 @@ namespace snmalloc
       sizeclass_t sizeclass)
     {
       stats().sizeclass_dealloc(sizeclass);
+      counters().medium_deallocated[sizeclass - NUM_SMALL_CLASSES] += 1;
       bool was_full = Mediumslab::dealloc(slab, p);
 
       auto slab_bounded = capptr_chunk_from_chunkd(slab, SUPERSLAB_SIZE);
 
       if (Mediumslab::empty(slab))
       {
+        counters().medium_slabs_deallocated[sizeclass - NUM_SMALL_CLASSES] +=
+          1;
         if (!was_full)
         {
           sizeclass_t medium_class = sizeclass - NUM_SMALL_CLASSES;
@@ -1416,9 +2315,9 @@ namespace snmalloc
       {
         // MSVC-vs-CapPtr triggering; xref CapPtr's constructor
         void* ret = InitThreadAllocator([size](void* alloc) {
-          CapPtr<void, CBAllocE> ret =
-            reinterpret_cast<Allocator*>(alloc)->large_alloc<zero_mem>(size);
-          return ret.unsafe_capptr;
+          auto* a = reinterpret_cast<Allocator*>(alloc);
+          CapPtr<void, CBAllocE> ret = a->template large_alloc<zero_mem>(size);
+          return a->check_sample(capptr_reveal(ret), size);
         });
         return CapPtr<void, CBAllocE>(ret);
       }
@@ -1432,14 +2331,21 @@ namespace snmalloc
       if (large_class == 0)
         size = rsize;
 
-      CapPtr<Largeslab, CBChunk> p =
-        large_allocator.template alloc<zero_mem>(large_class, rsize, size);
+      CapPtr<Largeslab, CBChunk> p;
+      {
+        LatencyTimer timer(counters().latency[SlowLargeAlloc]);
+        p = large_allocator.template alloc<zero_mem>(large_class, rsize, size);
+      }
       if (likely(p != nullptr))
       {
         chunkmap().set_large_size(p, size);
 
         stats().alloc_request(size);
         stats().large_alloc(large_class);
+        counters().large_allocated[large_class] += 1;
+        bytes_allocated += rsize;
+        if (alloc_tag != 0)
+          Tagmap::set(address_cast(p), alloc_tag);
       }
       return capptr_export(Aal::capptr_bound<void, CBAlloc>(p, rsize));
     }
@@ -1503,6 +2409,13 @@ namespace snmalloc
       chunkmap().clear_large_size(slab, size);
 
       stats().large_dealloc(large_class);
+      counters().large_deallocated[large_class] += 1;
+      bytes_deallocated += bits::one_at_bit(chunkmap_slab_kind);
+
+      alloc_tag_t tag = Tagmap::get(address_cast(slab));
+      if (tag != 0)
+        Tagmap::set(address_cast(slab), 0);
+      large_bytes_freed[tag] += bits::one_at_bit(chunkmap_slab_kind);
 
       // Initialise in order to set the correct SlabKind.
       slab->init();
@@ -1524,7 +2437,10 @@ namespace snmalloc
       if (remote_cache.capacity > 0)
       {
         stats().remote_free(sizeclass);
-        remote_cache.dealloc<Allocator>(target->trunc_id(), p, sizeclass);
+        bytes_deallocated += sizeclass_to_size(sizeclass);
+        remote_bytes_sent += sizeclass_to_size(sizeclass);
+        counters().remote_sent[remote_cache.dealloc<Allocator>(
+          target->trunc_id(), p, sizeclass)] += 1;
         return;
       }
 
@@ -1551,6 +2467,7 @@ namespace snmalloc
         return;
       }
 
+      LatencyTimer timer(counters().latency[SlowRemoteDealloc]);
       remote_dealloc_and_post(target, p_auth, sizeclass);
     }
 
@@ -1562,12 +2479,74 @@ namespace snmalloc
       handle_message_queue();
 
       stats().remote_free(sizeclass);
-      remote_cache.dealloc<Allocator>(target->trunc_id(), p_auth, sizeclass);
+      bytes_deallocated += sizeclass_to_size(sizeclass);
+      remote_bytes_sent += sizeclass_to_size(sizeclass);
+      counters().remote_sent[remote_cache.dealloc<Allocator>(
+        target->trunc_id(), p_auth, sizeclass)] += 1;
 
+      post_remote_cache();
+    }
+
+    /**
+     * Send everything in the remote cache to its owners.
+     */
+    void post_remote_cache()
+    {
       stats().remote_post();
+      counters().remote_posts += 1;
+      SNMALLOC_TRACEPOINT(
+        remote_post,
+        remote_bytes_sent - remote_bytes_posted,
+        static_cast<size_t>(counters().remote_posts));
+      remote_bytes_posted = remote_bytes_sent;
+      adapt_remote_cache();
+      remote_cache_age = 0;
       remote_cache.post<Allocator>(this, get_trunc_id());
     }
 
+    /**
+     * Choose the capacity of the remote cache before it is posted.  A cache
+     * that filled within a few slow paths grows, so a thread that frees a
+     * lot to other threads posts in large batches, and one that went stale
+     * before filling shrinks, so a thread that rarely frees to other threads
+     * holds less memory back.  The result is then limited to this
+     * allocator's share of `REMOTE_CACHE_SHARED`.
+     */
+    void adapt_remote_cache()
+    {
+      if (
+        (remote_cache.capacity <= 0) &&
+        (remote_cache_age < REMOTE_CACHE_MAX_AGE / 2))
+        remote_cache_target = bits::min(remote_cache_target * 2, REMOTE_CACHE);
+      else if (remote_cache_age >= REMOTE_CACHE_MAX_AGE)
+        remote_cache_target =
+          bits::max(remote_cache_target / 2, REMOTE_CACHE_MIN);
+
+      remote_cache.limit =
+        bits::min(remote_cache_target, RemoteCacheShare::share());
+    }
+
+    /**
+     * Bound how long memory freed by and to other threads stays out of use,
+     * called when this allocator's thread frees a large object or takes the
+     * slow path of a small free.  Medium frees only process the message
+     * queue, as they are too common to count towards the age of the remote
+     * cache.  A thread that frees much more than it allocates would
+     * otherwise only process its message queue when it allocates, and only
+     * post its remote cache when the cache fills.
+     */
+    void handle_remote_staleness()
+    {
+      handle_message_queue();
+
+      // The placeholder's remote cache must stay full.
+      if (remote_cache.is_empty() || NeedsInitialisation(this))
+        return;
+
+      if (++remote_cache_age >= REMOTE_CACHE_MAX_AGE)
+        post_remote_cache();
+    }
+
     ChunkMap& chunkmap()
     {
       return chunk_map;
@@ -46,6 +46,22 @@ namespace snmalloc
 #endif
     ;
 
+  // Divide this much memory between the remote caches of all the allocators
+  // in use, so that memory held in transit grows more slowly than the number
+  // of threads.  This is not a bound: each cache is still allowed
+  // REMOTE_CACHE_MIN, and can exceed its limit by the object that fills it.
+  static constexpr int64_t REMOTE_CACHE_SHARED =
+#ifdef USE_REMOTE_CACHE_SHARED
+    USE_REMOTE_CACHE_SHARED
+#else
+    REMOTE_CACHE * 16
+#endif
+    ;
+
+  // The smallest remote cache, for threads that free to other threads
+  // rarely, or when REMOTE_CACHE_SHARED is divided between many threads.
+  static constexpr int64_t REMOTE_CACHE_MIN = REMOTE_CACHE / 16;
+
   // Handle at most this many object from the remote dealloc queue at a time.
   static constexpr size_t REMOTE_BATCH =
 #ifdef USE_REMOTE_BATCH
@@ -55,6 +71,41 @@ namespace snmalloc
 #endif
     ;
 
+  // Batches grow up to this many objects while the remote dealloc queue
+  // stays busy.
+  static constexpr size_t REMOTE_BATCH_MAX = REMOTE_BATCH * 16;
+
+  // Sort objects from the remote dealloc queue by address in groups of this
+  // many, so that objects in the same slab are returned together.
+  static constexpr size_t REMOTE_SORT_BATCH =
+#ifdef USE_REMOTE_SORT_BATCH
+    USE_REMOTE_SORT_BATCH
+#else
+    64
+#endif
+    ;
+
+  // Split each allocator's remote dealloc queue into this many queues, each
+  // on its own cache line, so that many threads freeing to one allocator
+  // contend less on the queue's tail.
+  static constexpr size_t REMOTE_QUEUE_SHARDS =
+#ifdef USE_REMOTE_QUEUE_SHARDS
+    USE_REMOTE_QUEUE_SHARDS
+#else
+    1
+#endif
+    ;
+
+  // Send the remote cache to its owners once it has been held across this
+  // many large or slow small deallocations, even if it is not full.
+  static constexpr size_t REMOTE_CACHE_MAX_AGE =
+#ifdef USE_REMOTE_CACHE_MAX_AGE
+    USE_REMOTE_CACHE_MAX_AGE
+#else
+    64
+#endif
+    ;
+
   // Specifies smaller slab and super slab sizes for address space
   // constrained scenarios.
   static constexpr size_t USE_LARGE_CHUNKS =
@@ -153,4 +204,8 @@ namespace snmalloc
     "SLAB_COUNT must be a power of 2");
   static_assert(
     SLAB_COUNT <= (UINT8_MAX + 1), "SLAB_COUNT must fit in a uint8_t");
+  static_assert(
+    REMOTE_QUEUE_SHARDS >= 1, "REMOTE_QUEUE_SHARDS must be at least 1");
+  static_assert(
+    REMOTE_SORT_BATCH >= 1, "REMOTE_SORT_BATCH must be at least 1");
 } // namespace snmalloc
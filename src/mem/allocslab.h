@@ -2,6 +2,8 @@
 
 #include "baseslab.h"
 
+#include <atomic>
+
 namespace snmalloc
 {
   struct RemoteAllocator;
@@ -9,12 +11,23 @@ namespace snmalloc
   class Allocslab : public Baseslab
   {
   protected:
-    RemoteAllocator* allocator;
+    /**
+     * The owner of this slab.  Other threads read this when they free an
+     * object in the slab.  It changes only when a live allocator adopts the
+     * slab from a released one, so a thread that reads the previous owner
+     * sends its message there, and that allocator forwards it.
+     */
+    std::atomic<RemoteAllocator*> allocator;
 
   public:
     RemoteAllocator* get_allocator()
     {
-      return allocator;
+      return allocator.load(std::memory_order_relaxed);
+    }
+
+    void set_allocator(RemoteAllocator* alloc)
+    {
+      allocator.store(alloc, std::memory_order_relaxed);
     }
   };
 } // namespace snmalloc
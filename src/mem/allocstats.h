@@ -3,6 +3,7 @@
 #include "../ds/bits.h"
 #include "../mem/sizeclass.h"
 
+#include <atomic>
 #include <cstdint>
 
 #ifdef USE_SNMALLOC_STATS
@@ -15,6 +16,258 @@
 
 namespace snmalloc
 {
+  /**
+   * A counter that is only ever written by the thread that owns it, but may
+   * be read at any time by other threads.  Updates are a relaxed load and
+   * store, so they never need a locked instruction.
+   */
+  class RelaxedCounter
+  {
+    std::atomic<size_t> value{0};
+
+  public:
+    void operator+=(size_t n)
+    {
+      value.store(
+        value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    operator size_t() const
+    {
+      return value.load(std::memory_order_relaxed);
+    }
+  };
+
+  /**
+   * Slow paths whose latency can be recorded by `LatencyTimer`.
+   */
+  enum SlowPath
+  {
+    /**
+     * `small_alloc_rare`: building a new free list, from the bump pointer or
+     * a new slab.
+     */
+    SlowSmallAllocRare,
+    SlowAllocSlab,
+    /**
+     * Fetching a new medium slab in `medium_alloc`.
+     */
+    SlowMediumSlab,
+    SlowLargeAlloc,
+    SlowRemoteDealloc,
+    SlowMessageQueue,
+    /**
+     * Reserving a chunk from the address space manager for a large
+     * allocation or a new superslab or medium slab.
+     */
+    SlowReserve,
+    NUM_SLOW_PATHS
+  };
+
+  /**
+   * Slow path latencies are recorded in buckets of log2 ticks.  Bucket 0
+   * counts calls that took 0 ticks, bucket `b` those that took at least
+   * 2^(b-1) and less than 2^b ticks, and the last bucket everything longer.
+   */
+  static constexpr size_t NUM_LATENCY_BUCKETS = 40;
+
+  /**
+   * Posts of the remote cache are counted by the number of rounds they
+   * took, up to this many.  The last bucket also counts longer posts.
+   */
+  static constexpr size_t NUM_POST_ROUND_BUCKETS = 8;
+
+  inline const char* slow_path_name(size_t path)
+  {
+    static const char* names[NUM_SLOW_PATHS] = {"small_alloc_rare",
+                                                "alloc_slab",
+                                                "medium_slab",
+                                                "large_alloc",
+                                                "remote_dealloc",
+                                                "message_queue",
+                                                "reserve"};
+    return names[path];
+  }
+
+  /**
+   * Counters that are maintained in every build, unlike `AllocStats`, which
+   * only does anything with `USE_SNMALLOC_STATS`.
+   *
+   * Each allocator has its own set, and they are only updated on slow paths,
+   * so the fast paths are unaffected.  Small allocations are counted in
+   * batches when a thread-local free list is refilled, so `small_refilled`
+   * runs ahead of the number of objects actually handed out by at most one
+   * free list per sizeclass.  Small deallocations are not counted, as they
+   * never leave the fast path.
+   *
+   * Instantiated with `RelaxedCounter` for the per-allocator counters, and
+   * with `size_t` for totals aggregated from them (see
+   * `AllocPool::aggregate_counters`).
+   */
+  template<typename T>
+  struct AllocCountersT
+  {
+    T small_slabs_allocated[NUM_SMALL_CLASSES] = {};
+    T small_slabs_deallocated[NUM_SMALL_CLASSES] = {};
+    T small_refilled[NUM_SMALL_CLASSES] = {};
+    T medium_allocated[NUM_MEDIUM_CLASSES] = {};
+    T medium_deallocated[NUM_MEDIUM_CLASSES] = {};
+    T medium_slabs_allocated[NUM_MEDIUM_CLASSES] = {};
+    T medium_slabs_deallocated[NUM_MEDIUM_CLASSES] = {};
+    T large_allocated[NUM_LARGE_CLASSES] = {};
+    T large_deallocated[NUM_LARGE_CLASSES] = {};
+    T remote_posts = {};
+    T remote_received = {};
+
+    /**
+     * Objects freed by this allocator that belong to another, by the remote
+     * slot of their owner (see `RemoteCache::get_slot`).  Summed over the
+     * allocators, this is a matrix of remote free traffic between them.
+     */
+    T remote_sent[REMOTE_SLOTS] = {};
+
+    /**
+     * Objects received in this allocator's message queue that belong to
+     * another allocator, and so were forwarded on.
+     */
+    T remote_forwarded = {};
+
+    /**
+     * Posts of the remote cache, by the number of rounds of forwarding they
+     * needed to empty the cache, less one.
+     */
+    T remote_post_rounds[NUM_POST_ROUND_BUCKETS] = {};
+
+    /**
+     * Latency histograms of the slow paths, which are only recorded while
+     * `LatencyTimer` is enabled.
+     */
+    T latency[NUM_SLOW_PATHS][NUM_LATENCY_BUCKETS] = {};
+
+    template<typename U>
+    void add(const AllocCountersT<U>& that)
+    {
+      for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        small_slabs_allocated[i] += that.small_slabs_allocated[i];
+        small_slabs_deallocated[i] += that.small_slabs_deallocated[i];
+        small_refilled[i] += that.small_refilled[i];
+      }
+
+      for (size_t i = 0; i < NUM_MEDIUM_CLASSES; i++)
+      {
+        medium_allocated[i] += that.medium_allocated[i];
+        medium_deallocated[i] += that.medium_deallocated[i];
+        medium_slabs_allocated[i] += that.medium_slabs_allocated[i];
+        medium_slabs_deallocated[i] += that.medium_slabs_deallocated[i];
+      }
+
+      for (size_t i = 0; i < NUM_LARGE_CLASSES; i++)
+      {
+        large_allocated[i] += that.large_allocated[i];
+        large_deallocated[i] += that.large_deallocated[i];
+      }
+
+      remote_posts += that.remote_posts;
+      remote_received += that.remote_received;
+      remote_forwarded += that.remote_forwarded;
+
+      for (size_t i = 0; i < REMOTE_SLOTS; i++)
+        remote_sent[i] += that.remote_sent[i];
+
+      for (size_t i = 0; i < NUM_POST_ROUND_BUCKETS; i++)
+        remote_post_rounds[i] += that.remote_post_rounds[i];
+
+      for (size_t i = 0; i < NUM_SLOW_PATHS; i++)
+        for (size_t b = 0; b < NUM_LATENCY_BUCKETS; b++)
+          latency[i][b] += that.latency[i][b];
+    }
+
+    /**
+     * Bytes in medium and large allocations that are currently live.
+     */
+    size_t medium_and_large_bytes() const
+    {
+      size_t total = 0;
+
+      for (sizeclass_t i = 0; i < NUM_MEDIUM_CLASSES; i++)
+        total += (medium_allocated[i] - medium_deallocated[i]) *
+          sizeclass_to_size(i + NUM_SMALL_CLASSES);
+
+      for (uint8_t i = 0; i < NUM_LARGE_CLASSES; i++)
+        total += (large_allocated[i] - large_deallocated[i]) *
+          large_sizeclass_to_size(i);
+
+      return total;
+    }
+
+    /**
+     * Bytes in small slabs, and medium and large allocations, that are
+     * currently in use.  This is an upper bound on the bytes in live
+     * allocations, at slab granularity for small objects.
+     */
+    size_t active_bytes() const
+    {
+      size_t total = medium_and_large_bytes();
+
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+        total += (small_slabs_allocated[i] - small_slabs_deallocated[i]) *
+          SLAB_SIZE;
+
+      return total;
+    }
+  };
+
+  using AllocCounters = AllocCountersT<RelaxedCounter>;
+  using AllocCounterTotals = AllocCountersT<size_t>;
+
+  /**
+   * Records the time from its construction to its destruction in a slow path
+   * latency histogram of `AllocCounters`, if latency recording is enabled.
+   * When it is not, this costs a relaxed load and a branch.
+   */
+  class LatencyTimer
+  {
+    inline static std::atomic<bool> enabled{false};
+
+    RelaxedCounter* histogram;
+    uint64_t start;
+
+  public:
+    static bool is_enabled()
+    {
+      return enabled.load(std::memory_order_relaxed);
+    }
+
+    static void enable(bool on)
+    {
+      enabled.store(on, std::memory_order_relaxed);
+    }
+
+    static size_t bucket(uint64_t ticks)
+    {
+      if (ticks == 0)
+        return 0;
+      size_t t = static_cast<size_t>(bits::min<uint64_t>(ticks, SIZE_MAX));
+      return bits::min(bits::BITS - bits::clz(t), NUM_LATENCY_BUCKETS - 1);
+    }
+
+    SNMALLOC_FAST_PATH
+    LatencyTimer(RelaxedCounter (&histogram)[NUM_LATENCY_BUCKETS])
+    : histogram(is_enabled() ? histogram : nullptr),
+      start((this->histogram == nullptr) ? 0 : Aal::tick())
+    {}
+
+    SNMALLOC_FAST_PATH ~LatencyTimer()
+    {
+      if (histogram != nullptr)
+        histogram[bucket(Aal::tick() - start)] += 1;
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+  };
+
   template<size_t N, size_t LARGE_N>
   struct AllocStats
   {
@@ -224,6 +477,29 @@ namespace snmalloc
 #endif
     }
 
+    /**
+     * Move a slab of sizeclass `sc`, holding `objects` live objects, from
+     * the stats of `from` to these, when this allocator adopts the slab.
+     */
+    void sizeclass_adopt_slab(AllocStats& from, sizeclass_t sc, size_t objects)
+    {
+      UNUSED(from);
+      UNUSED(sc);
+      UNUSED(objects);
+
+#ifdef USE_SNMALLOC_STATS
+      from.sizeclass_dealloc_slab(sc);
+      sizeclass_alloc_slab(sc);
+      for (size_t i = 0;
+           (i < objects) && !from.sizeclass[sc].count.is_empty();
+           i++)
+      {
+        from.sizeclass[sc].count.dec();
+        sizeclass[sc].count.inc();
+      }
+#endif
+    }
+
     void large_dealloc(size_t sc)
     {
       UNUSED(sc);
@@ -31,12 +31,112 @@ namespace snmalloc
 
     Alloc* acquire()
     {
-      return Parent::acquire(Parent::memory_provider);
+      RemoteCacheShare::enter();
+      Alloc* a = Parent::acquire(Parent::memory_provider);
+      if (a->is_donor)
+      {
+        a->is_donor = false;
+        donors--;
+      }
+      set_adopt(a);
+      return a;
     }
 
+    /**
+     * Acquire a newly created allocator, which owns no memory.
+     */
+    Alloc* acquire_new()
+    {
+      RemoteCacheShare::enter();
+      Alloc* a = Parent::acquire_new(Parent::memory_provider);
+      set_adopt(a);
+      return a;
+    }
+
+    /**
+     * Return an allocator to the pool, when its thread exits.  The memory it
+     * holds that is not in use, such as its fast free lists and empty
+     * slabs, is reclaimed first, as is anything freed to it later by
+     * `cleanup_unused`.  Its partially used slabs are left for the next
+     * thread to acquire it, or are adopted by a live allocator when one
+     * next needs a superslab; see `adopt`.
+     *
+     * The pool does not free the allocator structures themselves when the
+     * number of threads drops.  The list of all allocators is walked
+     * without synchronisation, for statistics and `cleanup_unused`, so an
+     * allocator cannot be unlinked from it.  A released allocator may also
+     * still own superslabs whose slabs are all in use, and frees of their
+     * objects are sent to its message queue.
+     */
     void release(Alloc* a)
     {
+      a->reclaim();
+      if (a->has_adoptable())
+      {
+        a->is_donor = true;
+        donors++;
+      }
       Parent::release(a);
+      RemoteCacheShare::leave();
+    }
+
+  private:
+    /**
+     * The number of released allocators with slabs that `adopt` can take.
+     * This is static, as the pool cannot have fields of its own.
+     */
+    inline static std::atomic<size_t> donors{0};
+
+    static bool adopt_for(void* pool, Alloc* self)
+    {
+      return static_cast<AllocPool*>(pool)->adopt(self);
+    }
+
+    void set_adopt(Alloc* a)
+    {
+      a->adopt_released = &adopt_for;
+      a->adopt_pool = this;
+    }
+
+    /**
+     * Give `self`, which needs a superslab, the partially used slabs and
+     * superslabs of the first released allocator that has any, so that the
+     * memory of exited threads is reused rather than a new superslab being
+     * reserved.  The released allocators are taken out of the pool while
+     * they are walked, as in `cleanup_unused`, so a thread that starts
+     * meanwhile gets a new allocator.  Tagged allocators are not released
+     * to the pool, and do not adopt, so objects keep their tag.  Returns
+     * true if anything was adopted.
+     */
+    bool adopt(Alloc* self)
+    {
+      if ((donors.load(std::memory_order_relaxed) == 0) || (self->tag() != 0))
+        return false;
+
+      auto* first = Parent::extract();
+      if (first == nullptr)
+        return false;
+
+      bool adopted = false;
+      auto* alloc = first;
+      decltype(alloc) last;
+      while (alloc != nullptr)
+      {
+        if (!adopted && alloc->is_donor)
+        {
+          alloc->is_donor = false;
+          donors--;
+          // Take the messages that have arrived since it was released.
+          alloc->reclaim();
+          adopted = alloc->has_adoptable();
+          self->adopt(alloc);
+        }
+        last = alloc;
+        alloc = Parent::extract(alloc);
+      }
+
+      Parent::restore(first, last);
+      return adopted;
     }
 
   public:
@@ -51,6 +151,164 @@ namespace snmalloc
       }
     }
 
+    /**
+     * Sum the always-on counters of every allocator.  This is safe to call
+     * from any thread while the allocators are in use, though the totals
+     * are not a consistent snapshot.
+     */
+    void aggregate_counters(AllocCounterTotals& totals)
+    {
+      auto* alloc = Parent::iterate();
+
+      while (alloc != nullptr)
+      {
+        totals.add(alloc->counters());
+        alloc = Parent::iterate(alloc);
+      }
+    }
+
+    /**
+     * Fill in `report` with the state of the heap.  `self` is the caller's
+     * own allocator, if it has one, which is walked along with the
+     * allocators in the pool that no thread owns.  Those are taken out of
+     * the pool while they are walked, as in `cleanup_unused`, so a thread
+     * that starts meanwhile gets a new allocator.  The allocators of other
+     * threads only contribute their counters, so this is safe to call from
+     * any thread while allocation continues, though the report is not a
+     * consistent snapshot.
+     */
+    void heap_report(HeapReport& report, Alloc* self = nullptr)
+    {
+#ifndef SNMALLOC_PASS_THROUGH
+      size_t walked = report.walked_allocators;
+
+      auto* first = Parent::extract();
+
+      size_t total = 0;
+      for (auto* alloc = Parent::iterate(); alloc != nullptr;
+           alloc = Parent::iterate(alloc))
+      {
+        report.add_counters(alloc->counters());
+        total++;
+      }
+
+      if (self != nullptr)
+        self->walk_heap(report);
+
+      if (first != nullptr)
+      {
+        auto* alloc = first;
+        decltype(alloc) last;
+        while (alloc != nullptr)
+        {
+          alloc->walk_heap(report);
+          last = alloc;
+          alloc = Parent::extract(alloc);
+        }
+        Parent::restore(first, last);
+      }
+
+      walked = report.walked_allocators - walked;
+      report.busy_allocators += bits::max(total, walked) - walked;
+
+      Parent::memory_provider.walk_large_stacks(report);
+#else
+      UNUSED(report);
+      UNUSED(self);
+#endif
+    }
+
+    /**
+     * Read the counters of the `n`th allocator in the pool, and the slot
+     * that objects it owns are sent through by other allocators' remote
+     * caches.  Returns false if there are not that many allocators.  As with
+     * `aggregate_counters`, this can be called from any thread, though
+     * allocators created concurrently may change the numbering.
+     */
+    bool allocator_counters(size_t n, size_t& slot, AllocCounterTotals& totals)
+    {
+      auto* alloc = Parent::iterate();
+
+      for (; (alloc != nullptr) && (n > 0); n--)
+        alloc = Parent::iterate(alloc);
+
+      if (alloc == nullptr)
+        return false;
+
+      slot = alloc->remote_slot();
+      totals.add(alloc->counters());
+      return true;
+    }
+
+    /**
+     * The number of allocators in the pool, including those not currently
+     * owned by a thread.
+     */
+    size_t count_allocators()
+    {
+      size_t n = 0;
+      for (auto* alloc = Parent::iterate(); alloc != nullptr;
+           alloc = Parent::iterate(alloc))
+        n++;
+      return n;
+    }
+
+    /**
+     * Sum the live bytes of each allocation tag over every allocator.  As
+     * with `aggregate_counters`, this can be called from any thread.
+     */
+    void aggregate_tag_bytes(int64_t (&live)[NUM_ALLOC_TAGS])
+    {
+      auto* alloc = Parent::iterate();
+
+      while (alloc != nullptr)
+      {
+        alloc->add_tag_bytes(live);
+        alloc = Parent::iterate(alloc);
+      }
+    }
+
+    /**
+     * Sum the bytes freed by every allocator that are waiting to be returned
+     * to their owners, in remote caches and in message queues.  As with
+     * `aggregate_counters`, this can be called from any thread.
+     */
+    void aggregate_remote_bytes(int64_t& cached, int64_t& queued)
+    {
+      auto* alloc = Parent::iterate();
+
+      while (alloc != nullptr)
+      {
+        alloc->add_remote_bytes(cached, queued);
+        alloc = Parent::iterate(alloc);
+      }
+    }
+
+    /**
+     * Run `f` once, after the next allocation by any allocator.  See
+     * `DeferredWork`.
+     */
+    void defer(void (*f)())
+    {
+      DeferredWork::add(f);
+      reschedule_samples();
+    }
+
+    /**
+     * Make every allocator choose a new heap profiler sampling point, after
+     * profiling has been started or stopped.
+     */
+    void reschedule_samples()
+    {
+      auto* alloc = Parent::iterate();
+
+      while (alloc != nullptr)
+      {
+        alloc->reschedule_sample();
+        alloc = Parent::iterate(alloc);
+      }
+    }
+
 #ifdef USE_SNMALLOC_STATS
     void print_all_stats(std::ostream& o, uint64_t dumpid = 0)
     {
@@ -76,7 +334,7 @@ namespace snmalloc
       // Call this periodically to free and coalesce memory allocated by
       // allocators that are not currently in use by any thread.
       // One atomic operation to extract the stack, another to restore it.
-      // Handling the message queue for each stack is non-atomic.
+      // Reclaiming the memory of each allocator is non-atomic.
       auto* first = Parent::extract();
       auto* alloc = first;
       decltype(alloc) last;
@@ -85,16 +343,40 @@ namespace snmalloc
       {
         while (alloc != nullptr)
         {
-          alloc->handle_message_queue();
+          alloc->reclaim();
           last = alloc;
           alloc = Parent::extract(alloc);
         }
 
-        restore(first, last);
+        Parent::restore(first, last);
       }
 #endif
     }
 
+    /**
+     * Return as much unused memory as possible to the OS: reclaim the
+     * memory of `self`, the caller's allocator, and of the allocators that
+     * no thread is using, and decommit the chunks cached in the large
+     * stacks.  Returns the bytes decommitted, including any decommitted
+     * concurrently by other threads.  `self` may be the placeholder
+     * allocator, if the calling thread has not allocated yet.
+     */
+    size_t trim(Alloc* self)
+    {
+#ifndef SNMALLOC_PASS_THROUGH
+      auto& mp = Parent::memory_provider;
+      size_t decommitted = mp.total_decommitted();
+      cleanup_unused();
+      // The placeholder has no memory provider, so purge the pool's.
+      self->reclaim();
+      mp.purge();
+      return mp.total_decommitted() - decommitted;
+#else
+      UNUSED(self);
+      return 0;
+#endif
+    }
+
     /**
       If you pass a pointer to a bool, then it returns whether all the
       allocators are empty. If you don't pass a pointer to a bool, then will
@@ -123,7 +405,7 @@ namespace snmalloc
 
           // Post all remotes, including forwarded ones. If any allocator posts,
           // repeat the loop.
-          if (alloc->remote_cache.capacity < REMOTE_CACHE)
+          if (!alloc->remote_cache.is_empty())
           {
             alloc->stats().remote_post();
             alloc->remote_cache.post(alloc, alloc->get_trunc_id());
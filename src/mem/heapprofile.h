@@ -0,0 +1,393 @@
+#pragma once
+
+#include "../ds/address.h"
+#include "../ds/flaglock.h"
+#include "largealloc.h"
+
+#include <atomic>
+#include <cmath>
+#include <string.h>
+
+namespace snmalloc
+{
+  /**
+   * Sampling heap profiler.
+   *
+   * Each allocator samples an allocation roughly every `interval` bytes that
+   * it allocates, with the distance between samples drawn from an
+   * exponential distribution so that the samples are not biased by
+   * allocation patterns.  The allocator compares its running total of
+   * allocated bytes against the point of its next sample, so an allocation
+   * that is not sampled costs a load and a compare.
+   *
+   * A sampled allocation has its stack captured and is recorded in a side
+   * table, keyed by address, until it is freed.  Stacks are aggregated into
+   * buckets that count both the live and the cumulative allocations made
+   * from them.  Deallocation only has to look in the table while there are
+   * live samples, and then the lookup is a lock-free probe of an
+   * open-addressed table.
+   *
+   * The tables have a fixed size and are only created when profiling is
+   * first activated.  Samples that do not fit are dropped and counted.
+   */
+  class HeapProfile
+  {
+  public:
+    /**
+     * Maximum number of frames recorded for each stack.
+     */
+    static constexpr size_t MAX_FRAMES = 32;
+
+    /**
+     * The default mean number of bytes between samples.
+     */
+    static constexpr size_t DEFAULT_INTERVAL = 512 * 1024;
+
+    /**
+     * Allocations made from a single stack.
+     */
+    struct Bucket
+    {
+      size_t hash;
+      size_t depth;
+      void* frames[MAX_FRAMES];
+      size_t allocs;
+      size_t alloc_bytes;
+      size_t frees;
+      size_t free_bytes;
+    };
+
+  private:
+    static constexpr size_t SAMPLE_SLOTS = 1 << 16;
+    static constexpr size_t BUCKET_SLOTS = 1 << 12;
+    static constexpr size_t MAX_PROBES = 64;
+
+    /**
+     * Marks a sample slot whose record has been removed.  Lookups continue
+     * past it, and insertions may reuse it.  Tombstones at the end of a
+     * probe sequence are cleared as soon as they are made (see `remove`), so
+     * they only build up in front of live records.
+     */
+    static constexpr address_t TOMBSTONE = 1;
+
+    struct Sample
+    {
+      std::atomic<address_t> address;
+      Bucket* bucket;
+      size_t size;
+    };
+
+    struct Tables
+    {
+      Sample samples[SAMPLE_SLOTS];
+      Bucket buckets[BUCKET_SLOTS];
+    };
+
+    inline static std::atomic<Tables*> tables{nullptr};
+    inline static std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    inline static std::atomic<size_t> interval{DEFAULT_INTERVAL};
+    inline static std::atomic<bool> active{false};
+    inline static std::atomic<size_t> live_samples{0};
+    inline static size_t dropped = 0;
+
+    template<typename PAL>
+    static auto capture_stack(void** frames, size_t max, int)
+      -> decltype(PAL::capture_stack_trace(frames, max))
+    {
+      return PAL::capture_stack_trace(frames, max);
+    }
+
+    template<typename PAL>
+    static size_t capture_stack(void** frames, size_t max, long)
+    {
+      UNUSED(frames);
+      UNUSED(max);
+      return 0;
+    }
+
+    static size_t hash_address(address_t a)
+    {
+      // Allocations are at least 16-byte aligned, so drop the low bits.
+      return static_cast<size_t>((a >> 4) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    static size_t hash_stack(void* const* frames, size_t depth)
+    {
+      uint64_t h = 0xcbf29ce484222325ULL;
+      for (size_t i = 0; i < depth; i++)
+      {
+        h ^= static_cast<uint64_t>(address_cast(frames[i]));
+        h *= 0x100000001b3ULL;
+      }
+      return static_cast<size_t>(h);
+    }
+
+    /**
+     * Find or create the bucket for a stack.  Called with the lock held.
+     */
+    static Bucket* find_bucket(Tables* t, void* const* frames, size_t depth)
+    {
+      size_t h = hash_stack(frames, depth);
+      for (size_t i = 0; i < MAX_PROBES; i++)
+      {
+        Bucket& b = t->buckets[(h + i) & (BUCKET_SLOTS - 1)];
+        if (b.depth == 0)
+        {
+          b.hash = h;
+          b.depth = depth;
+          for (size_t j = 0; j < depth; j++)
+            b.frames[j] = frames[j];
+          return &b;
+        }
+
+        if (
+          (b.hash == h) && (b.depth == depth) &&
+          (memcmp(b.frames, frames, depth * sizeof(void*)) == 0))
+          return &b;
+      }
+      return nullptr;
+    }
+
+    static Tables* get_tables()
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      if (t != nullptr)
+        return t;
+
+      FlagLock f(lock);
+      t = tables.load(std::memory_order_relaxed);
+      if (t == nullptr)
+      {
+        t = default_memory_provider().alloc_chunk<Tables, 1>();
+        tables.store(t, std::memory_order_release);
+      }
+      return t;
+    }
+
+    /**
+     * Remove the record for `p`, if it was sampled.
+     */
+    static SNMALLOC_SLOW_PATH void remove(void* p)
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      address_t a = address_cast(p);
+      if ((t == nullptr) || (a == 0))
+        return;
+
+      size_t h = hash_address(a);
+      for (size_t i = 0; i < MAX_PROBES; i++)
+      {
+        Sample& s = t->samples[(h + i) & (SAMPLE_SLOTS - 1)];
+        address_t found = s.address.load(std::memory_order_acquire);
+        if (found == 0)
+          return;
+
+        if (found == a)
+        {
+          FlagLock f(lock);
+          if (s.address.load(std::memory_order_relaxed) == a)
+          {
+            s.bucket->frees++;
+            s.bucket->free_bytes += s.size;
+            s.address.store(TOMBSTONE, std::memory_order_relaxed);
+            live_samples.fetch_sub(1, std::memory_order_relaxed);
+            clear_tombstones(t, h + i);
+          }
+          return;
+        }
+      }
+    }
+
+    /**
+     * Empty the tombstone at `slot`, and the run of tombstones before it, if
+     * the slot after it is empty.  No probe sequence for a live record runs
+     * through an empty slot, so none can run through these slots either,
+     * and lookups that are in progress without the lock do not miss a
+     * record.  Called with the lock held.
+     */
+    static void clear_tombstones(Tables* t, size_t slot)
+    {
+      Sample& next = t->samples[(slot + 1) & (SAMPLE_SLOTS - 1)];
+      if (next.address.load(std::memory_order_relaxed) != 0)
+        return;
+
+      for (size_t i = 0; i < MAX_PROBES; i++)
+      {
+        Sample& s = t->samples[(slot - i) & (SAMPLE_SLOTS - 1)];
+        if (s.address.load(std::memory_order_relaxed) != TOMBSTONE)
+          return;
+        s.address.store(0, std::memory_order_relaxed);
+      }
+    }
+
+  public:
+    /**
+     * Returns the number of bytes to allocate before the next sample, given
+     * a random value, or `UINT64_MAX` if profiling is not active.
+     */
+    static uint64_t next_sample(uint64_t random)
+    {
+      if (!active.load(std::memory_order_relaxed))
+        return UINT64_MAX;
+
+      // An exponentially distributed distance with the configured mean,
+      // from a uniform value in (0, 1].
+      double u = (static_cast<double>(random >> 11) + 1.0) /
+        static_cast<double>(1ULL << 53);
+      double mean = static_cast<double>(interval.load(std::memory_order_relaxed));
+      return static_cast<uint64_t>(-std::log(u) * mean) + 1;
+    }
+
+    /**
+     * Record a sampled allocation of `size` bytes at `p`.
+     */
+    static SNMALLOC_SLOW_PATH void record(void* p, size_t size)
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      if ((t == nullptr) || (p == nullptr))
+        return;
+
+      // Capture the stack before taking the lock: the unwinder may allocate
+      // the first time that it is used.
+      void* frames[MAX_FRAMES];
+      size_t depth = capture_stack<Pal>(frames, MAX_FRAMES, 0);
+      if (depth == 0)
+      {
+        // Keep the allocation, attributed to an unknown stack.
+        frames[0] = nullptr;
+        depth = 1;
+      }
+
+      FlagLock f(lock);
+      Bucket* b = find_bucket(t, frames, depth);
+      if (b == nullptr)
+      {
+        dropped++;
+        return;
+      }
+
+      size_t h = hash_address(address_cast(p));
+      for (size_t i = 0; i < MAX_PROBES; i++)
+      {
+        Sample& s = t->samples[(h + i) & (SAMPLE_SLOTS - 1)];
+        address_t found = s.address.load(std::memory_order_relaxed);
+        if ((found == 0) || (found == TOMBSTONE))
+        {
+          b->allocs++;
+          b->alloc_bytes += size;
+          s.bucket = b;
+          s.size = size;
+          s.address.store(address_cast(p), std::memory_order_release);
+          live_samples.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+      }
+      dropped++;
+    }
+
+    /**
+     * Called for every deallocation.
+     */
+    static SNMALLOC_FAST_PATH void on_dealloc(void* p)
+    {
+      if (unlikely(live_samples.load(std::memory_order_relaxed) != 0))
+        remove(p);
+    }
+
+    static bool is_active()
+    {
+      return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Start or stop sampling.  Allocators pick up the change at their next
+     * sample, so callers should also reschedule the allocators' samples.
+     * Returns false if the tables could not be created.
+     */
+    static bool set_active(bool on)
+    {
+      if (on && (get_tables() == nullptr))
+        return false;
+      active.store(on, std::memory_order_relaxed);
+      return true;
+    }
+
+    static size_t get_interval()
+    {
+      return interval.load(std::memory_order_relaxed);
+    }
+
+    static void set_interval(size_t bytes)
+    {
+      interval.store(bits::max<size_t>(bytes, 1), std::memory_order_relaxed);
+    }
+
+    /**
+     * Discard the cumulative counts, so that each bucket only counts its live
+     * allocations.
+     */
+    static void reset()
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      if (t == nullptr)
+        return;
+
+      FlagLock f(lock);
+      for (auto& b : t->buckets)
+      {
+        b.allocs -= b.frees;
+        b.alloc_bytes -= b.free_bytes;
+        b.frees = 0;
+        b.free_bytes = 0;
+      }
+    }
+
+    /**
+     * The number of samples that have been dropped because the tables were
+     * full.
+     */
+    static size_t dropped_samples()
+    {
+      FlagLock f(lock);
+      return dropped;
+    }
+
+    /**
+     * The number of tombstones in the sample table, for testing.
+     */
+    static size_t debug_tombstones()
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      if (t == nullptr)
+        return 0;
+
+      FlagLock f(lock);
+      size_t n = 0;
+      for (auto& s : t->samples)
+      {
+        if (s.address.load(std::memory_order_relaxed) == TOMBSTONE)
+          n++;
+      }
+      return n;
+    }
+
+    /**
+     * Call `f` on every bucket, with the profiler locked.  `f` must not
+     * allocate.
+     */
+    template<typename F>
+    static void for_each_bucket(F f)
+    {
+      Tables* t = tables.load(std::memory_order_acquire);
+      if (t == nullptr)
+        return;
+
+      FlagLock l(lock);
+      for (auto& b : t->buckets)
+      {
+        if (b.depth != 0)
+          f(b);
+      }
+    }
+  };
+} // namespace snmalloc
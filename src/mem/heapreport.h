@@ -0,0 +1,172 @@
+#pragma once
+
+#include "allocstats.h"
+#include "sizeclass.h"
+
+namespace snmalloc
+{
+  /**
+   * How full the slab holding an object is, and how full the slabs of its
+   * sizeclass are, for deciding whether moving the object would help to
+   * empty sparsely used slabs.  This has the layout of the result of
+   * jemalloc's `experimental.utilization.query`.
+   */
+  struct SlabUtilization
+  {
+    size_t nfree;
+    size_t nregs;
+    size_t size;
+    size_t bin_nfree;
+    size_t bin_nregs;
+  };
+
+  /**
+   * A report of where the heap's memory is, for telling live data apart
+   * from fragmentation and from memory cached for reuse.  It is filled in by
+   * `AllocPool::heap_report`.
+   *
+   * Allocators that are owned by other threads cannot be walked without
+   * stopping them, so they only contribute their `AllocCounters`: the slabs
+   * of each sizeclass, the live medium and large objects, and the free
+   * objects in medium slabs.  The caller's own allocator and those waiting
+   * in the pool for a thread are walked, which adds the free, cached and
+   * reserve objects of small sizeclasses, estimates of their live objects,
+   * and the occupancy of their superslabs.
+   */
+  struct HeapReport
+  {
+    struct Sizeclass
+    {
+      /**
+       * Slabs, or for medium sizeclasses medium slabs, holding objects of
+       * this sizeclass.
+       */
+      size_t slabs = 0;
+
+      /**
+       * Objects allocated and not yet freed.  Objects freed by another
+       * thread are live until their owner processes them.  For small
+       * sizeclasses, this only covers walked allocators, and is an upper
+       * bound: up to a few objects that have been freed back to full slabs,
+       * and the objects missing from short slabs, are counted as live.
+       */
+      size_t live_objects = 0;
+
+      /**
+       * Free objects in slabs that are not in use by the fast path, which
+       * will be allocated before any new slab is used.
+       */
+      size_t free_objects = 0;
+
+      /**
+       * Free objects on the allocators' fast free lists.
+       */
+      size_t cached_objects = 0;
+
+      /**
+       * Objects not yet carved from the allocators' bump pointers.
+       */
+      size_t reserve_objects = 0;
+    };
+
+    struct LargeClass
+    {
+      /**
+       * Allocations of this class that have not been freed.
+       */
+      size_t live = 0;
+
+      /**
+       * Chunks of this size cached for reuse in the large stacks, which are
+       * still committed, and which have been decommitted.
+       */
+      size_t cached = 0;
+      size_t decommitted = 0;
+    };
+
+    size_t walked_allocators = 0;
+    size_t busy_allocators = 0;
+
+    Sizeclass sizeclasses[NUM_SIZECLASSES] = {};
+
+    /**
+     * Superslabs of walked allocators that have a free slab, by the number
+     * of slabs in use, where the short slab counts as one.  Superslabs with
+     * no free slab are not reachable from their allocators.
+     */
+    size_t superslab_occupancy[SLAB_COUNT + 1] = {};
+
+    LargeClass large_classes[NUM_LARGE_CLASSES] = {};
+
+    /**
+     * Add the parts of the report that come from one allocator's counters.
+     */
+    template<typename T>
+    void add_counters(const AllocCountersT<T>& counters)
+    {
+      for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+        sizeclasses[i].slabs += counters.small_slabs_allocated[i] -
+          counters.small_slabs_deallocated[i];
+
+      for (sizeclass_t i = 0; i < NUM_MEDIUM_CLASSES; i++)
+      {
+        auto& sc = sizeclasses[i + NUM_SMALL_CLASSES];
+        size_t slabs = counters.medium_slabs_allocated[i] -
+          counters.medium_slabs_deallocated[i];
+        size_t live =
+          counters.medium_allocated[i] - counters.medium_deallocated[i];
+        sc.slabs += slabs;
+        sc.live_objects += live;
+        sc.free_objects += bits::max<size_t>(
+          slabs * medium_slab_free(i + NUM_SMALL_CLASSES), live) - live;
+      }
+
+      for (size_t i = 0; i < NUM_LARGE_CLASSES; i++)
+        large_classes[i].live +=
+          counters.large_allocated[i] - counters.large_deallocated[i];
+    }
+
+    /**
+     * Write the report as a single JSON object.  Sizeclasses with no slabs
+     * and large classes with no chunks are left out.
+     */
+    template<typename Out>
+    void write_json(Out& out) const
+    {
+      out << "{\"walked_allocators\":" << walked_allocators
+          << ",\"busy_allocators\":" << busy_allocators << ",\"sizeclasses\":[";
+      const char* sep = "";
+      for (sizeclass_t i = 0; i < NUM_SIZECLASSES; i++)
+      {
+        auto& sc = sizeclasses[i];
+        if (
+          (sc.slabs == 0) && (sc.free_objects == 0) &&
+          (sc.cached_objects == 0) && (sc.reserve_objects == 0))
+          continue;
+        out << sep << "{\"size\":" << sizeclass_to_size(i)
+            << ",\"slabs\":" << sc.slabs << ",\"live\":" << sc.live_objects
+            << ",\"free\":" << sc.free_objects
+            << ",\"cached\":" << sc.cached_objects
+            << ",\"reserve\":" << sc.reserve_objects << "}";
+        sep = ",";
+      }
+      out << "],\"superslab_occupancy\":[";
+      for (size_t i = 0; i <= SLAB_COUNT; i++)
+        out << ((i == 0) ? "" : ",") << superslab_occupancy[i];
+      out << "],\"large\":[";
+      sep = "";
+      for (size_t i = 0; i < NUM_LARGE_CLASSES; i++)
+      {
+        auto& lc = large_classes[i];
+        if ((lc.live == 0) && (lc.cached == 0) && (lc.decommitted == 0))
+          continue;
+        out << sep << "{\"size\":"
+            << large_sizeclass_to_size(static_cast<uint8_t>(i))
+            << ",\"live\":" << lc.live << ",\"cached\":" << lc.cached
+            << ",\"decommitted\":" << lc.decommitted << "}";
+        sep = ",";
+      }
+      out << "]}\n";
+    }
+  };
+} // namespace snmalloc
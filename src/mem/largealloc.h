@@ -7,6 +7,7 @@
 #include "address_space.h"
 #include "allocstats.h"
 #include "baseslab.h"
+#include "heapreport.h"
 #include "sizeclass.h"
 
 #include <new>
@@ -99,6 +100,11 @@ namespace snmalloc
      */
     std::atomic<size_t> available_large_chunks_in_bytes{0};
 
+    /**
+     * Bytes of cached chunks that have been decommitted.
+     */
+    std::atomic<size_t> decommitted_bytes{0};
+
     /**
      * Stack of large allocations that have been returned for reuse.
      */
@@ -199,17 +205,43 @@ namespace snmalloc
       {
         return;
       }
+      size_t decommitted = decommit_large_stacks<true>();
+      SNMALLOC_TRACEPOINT(lazy_decommit, decommitted);
+      UNUSED(decommitted);
+      lazy_decommit_guard.clear();
+    }
+
+    /**
+     * Decommit all but the first page of every chunk that is cached in the
+     * large stacks and has not already been decommitted.  If
+     * `only_under_pressure` is set, stop as soon as the platform no longer
+     * reports that memory is low.  Returns the number of bytes decommitted.
+     */
+    template<bool only_under_pressure>
+    size_t decommit_large_stacks()
+    {
+      size_t decommitted = 0;
       // When we hit low memory, iterate over size classes and decommit all of
       // the memory that we can.  Start with the small size classes so that we
       // hit cached superslabs first.
       // FIXME: We probably shouldn't do this all at once.
-      // FIXME: We currently Decommit all the sizeclasses larger than 0.
       for (size_t large_class = 0; large_class < NUM_LARGE_CLASSES;
            large_class++)
       {
-        if (!PAL::expensive_low_memory_check())
+        if constexpr (only_under_pressure)
+        {
+          if (!PAL::expensive_low_memory_check())
+          {
+            break;
+          }
+        }
+        // Cross-reference LargeAlloc::dealloc's decommitment condition: these
+        // chunks were decommitted when they were pushed.
+        if (
+          (decommit_strategy != DecommitNone) &&
+          (large_class != 0 || decommit_strategy == DecommitSuper))
         {
-          break;
+          continue;
         }
         size_t rsize = bits::one_at_bit(SUPERSLAB_BITS) << large_class;
         size_t decommit_size = rsize - OS_PAGE_SIZE;
@@ -221,8 +253,8 @@ namespace snmalloc
           // the stack.
           if (slab->get_kind() != Decommitted)
           {
-            PAL::notify_not_using(
-              pointer_offset(slab.unsafe_capptr, OS_PAGE_SIZE), decommit_size);
+            decommit_chunk(slab, rsize);
+            decommitted += decommit_size;
           }
           // Once we've removed these from the stack, there will be no
           // concurrent accesses and removal should have established a
@@ -234,7 +266,7 @@ namespace snmalloc
           slab = next;
         }
       }
-      lazy_decommit_guard.clear();
+      return decommitted;
     }
 
     class LowMemoryNotificationObject : public PalNotificationObject
@@ -258,6 +290,41 @@ namespace snmalloc
     };
 
   public:
+    /**
+     * Count the chunks cached in the large stacks into `report`.  Each stack
+     * is emptied while it is counted, as in `decommit_large_stacks`, so a
+     * large allocation in the meantime may use fresh address space rather
+     * than a cached chunk.
+     */
+    void walk_large_stacks(HeapReport& report)
+    {
+      for (size_t large_class = 0; large_class < NUM_LARGE_CLASSES;
+           large_class++)
+      {
+        // Cross-reference LargeAlloc::dealloc's decommitment condition: these
+        // chunks were decommitted when they were pushed.
+        bool decommitted_on_push = (decommit_strategy != DecommitNone) &&
+          (large_class != 0 || decommit_strategy == DecommitSuper);
+
+        CapPtr<Largeslab, CBChunk> first = large_stack[large_class].pop_all();
+        if (first == nullptr)
+          continue;
+
+        auto& counts = report.large_classes[large_class];
+        CapPtr<Largeslab, CBChunk> last;
+        for (auto slab = first; slab != nullptr;
+             slab = slab->next.load(std::memory_order_relaxed))
+        {
+          if (decommitted_on_push || (slab->get_kind() == Decommitted))
+            counts.decommitted++;
+          else
+            counts.cached++;
+          last = slab;
+        }
+        large_stack[large_class].push(first, last);
+      }
+    }
+
     /**
      * Primitive allocator for structure that are required before
      * the allocator can be running.
@@ -287,6 +354,39 @@ namespace snmalloc
         .template as_static<Largeslab>();
     }
 
+    /**
+     * Decommit the cached chunks in the large stacks, returning their memory
+     * to the OS while keeping the address space for reuse.  This is safe to
+     * call concurrently with other accesses.  Returns the number of bytes
+     * decommitted.
+     */
+    SNMALLOC_SLOW_PATH size_t purge()
+    {
+      return decommit_large_stacks<false>();
+    }
+
+    /**
+     * Decommit all except for the first page of `p`, a chunk of `rsize`
+     * bytes that is, or is about to be, cached in the large stacks.
+     */
+    void decommit_chunk(CapPtr<Largeslab, CBChunk> p, size_t rsize)
+    {
+      PAL::notify_not_using(
+        pointer_offset(p, OS_PAGE_SIZE).unsafe_capptr, rsize - OS_PAGE_SIZE);
+      decommitted_bytes += rsize - OS_PAGE_SIZE;
+    }
+
+    /**
+     * The total bytes of cached chunks that have been decommitted, as they
+     * were cached, by `purge`, or by lazy decommit.  The difference across
+     * an operation is the memory it returned to the OS, along with any
+     * returned concurrently by other threads.
+     */
+    size_t total_decommitted()
+    {
+      return decommitted_bytes;
+    }
+
     /**
      * Returns a pair of current memory usage and peak memory usage.
      * Both statistics are very coarse-grained.
@@ -325,6 +425,9 @@ namespace snmalloc
     // This will be a zero-size structure if stats are not enabled.
     Stats stats;
 
+    // These are maintained whether or not stats are enabled.
+    AllocCounters counters;
+
     MemoryProvider& memory_provider;
 
     LargeAlloc(MemoryProvider& mp) : memory_provider(mp) {}
@@ -341,22 +444,28 @@ namespace snmalloc
 
       if (p == nullptr)
       {
-        p = memory_provider.template reserve<false>(large_class);
+        {
+          LatencyTimer timer(counters.latency[SlowReserve]);
+          p = memory_provider.template reserve<false>(large_class);
+        }
         if (p == nullptr)
           return nullptr;
         MemoryProvider::Pal::template notify_using<zero_mem>(
           p.unsafe_capptr, rsize);
+        SNMALLOC_TRACEPOINT(large_alloc, large_class, rsize, 0, 1);
       }
       else
       {
         stats.superslab_pop();
 
         // Cross-reference alloc.h's large_dealloc decommitment condition.
+        // Chunks of any class may also have been decommitted by `purge` or
+        // by lazy decommit, which mark them as `Decommitted`.
         bool decommitted =
-          ((decommit_strategy == DecommitSuperLazy) &&
-           (p.template as_static<Baseslab>().unsafe_capptr->get_kind() ==
-            Decommitted)) ||
+          (p.template as_static<Baseslab>().unsafe_capptr->get_kind() ==
+           Decommitted) ||
           (large_class > 0) || (decommit_strategy == DecommitSuper);
+        SNMALLOC_TRACEPOINT(large_alloc, large_class, rsize, 1, decommitted);
 
         if (decommitted)
         {
@@ -404,12 +513,12 @@ namespace snmalloc
         (decommit_strategy != DecommitNone) &&
         (large_class != 0 || decommit_strategy == DecommitSuper))
       {
-        MemoryProvider::Pal::notify_not_using(
-          pointer_offset(p, OS_PAGE_SIZE).unsafe_capptr, rsize - OS_PAGE_SIZE);
+        memory_provider.decommit_chunk(p, rsize);
       }
 
       stats.superslab_push();
       memory_provider.push_large_stack(p, large_class);
+      SNMALLOC_TRACEPOINT(large_dealloc, large_class, rsize);
     }
 
     template<
@@ -75,7 +75,7 @@ namespace snmalloc
       SNMALLOC_ASSERT(sc >= NUM_SMALL_CLASSES);
       SNMALLOC_ASSERT((sc - NUM_SMALL_CLASSES) < NUM_MEDIUM_CLASSES);
 
-      self->allocator = alloc;
+      self->set_allocator(alloc);
       self->head = 0;
 
       // If this was previously a Mediumslab of the same sizeclass, don't
@@ -146,6 +146,12 @@ namespace snmalloc
       return self->head == 0;
     }
 
+    template<SNMALLOC_CONCEPT(capptr_bounds::c) B>
+    static uint16_t free_count(CapPtr<Mediumslab, B> self)
+    {
+      return self->free;
+    }
+
   private:
     uint16_t address_to_index(address_t p)
     {
@@ -96,6 +96,20 @@ namespace snmalloc
       return (--needed()) == 0;
     }
 
+    /**
+     * Updates statistics for adding `n` entries to the free list at once, if
+     * none of them would make `return_object` return true.  Otherwise this
+     * returns false and changes nothing, and each entry must be returned
+     * with `return_object`.
+     */
+    bool return_objects(uint16_t n)
+    {
+      if (needed() <= n)
+        return false;
+      needed() -= n;
+      return true;
+    }
+
     bool is_unused()
     {
       return needed() == 0;
@@ -57,9 +57,19 @@ namespace snmalloc
         return p;
       }
 
-      p = memory_provider
-            .template alloc_chunk<T, bits::next_pow2_const(sizeof(T))>(
-              std::forward<Args...>(args)...);
+      return acquire_new(std::forward<Args...>(args)...);
+    }
+
+    /**
+     * Create a new object, rather than reusing one that has been released.
+     * The object is still added to the list of all objects.
+     */
+    template<typename... Args>
+    T* acquire_new(Args&&... args)
+    {
+      T* p = memory_provider
+               .template alloc_chunk<T, bits::next_pow2_const(sizeof(T))>(
+                 std::forward<Args...>(args)...);
 
       FlagLock f(lock);
       p->list_next = list;
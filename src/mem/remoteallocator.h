@@ -44,11 +44,11 @@ namespace snmalloc
      * as MTE + CHERI.
      *
      * We embed the size class in the bottom 8 bits of an allocator ID (i.e.,
-     * the address of an Alloc's remote_alloc's message_queue; in practice we
-     * only need 7 bits, but using 8 is conjectured to be faster).  The hashing
-     * algorithm of the Alloc's RemoteCache already ignores the bottom
-     * "initial_shift" bits, which is, in practice, well above 8.  There's a
-     * static_assert() over there that helps ensure this stays true.
+     * the address of an Alloc's remote_alloc's first message queue; in
+     * practice we only need 7 bits, but using 8 is conjectured to be faster).
+     * The hashing algorithm of the Alloc's RemoteCache already ignores the
+     * bottom "initial_shift" bits, which is, in practice, well above 8.
+     * There's a static_assert() over there that helps ensure this stays true.
      *
      * This does mean that we might have message_queues that always collide in
      * the hash algorithm, if they're within "initial_shift" of each other. Such
@@ -114,15 +114,37 @@ namespace snmalloc
   struct RemoteAllocator
   {
     using alloc_id_t = Remote::alloc_id_t;
-    // Store the message queue on a separate cacheline. It is mutable data that
-    // is read by other threads.
-    alignas(CACHELINE_SIZE)
-      MPSCQ<Remote, CapPtrCBAlloc, AtomicCapPtrCBAlloc> message_queue;
+    using MessageQueue = MPSCQ<Remote, CapPtrCBAlloc, AtomicCapPtrCBAlloc>;
+
+    // Store each message queue on a separate cacheline. It is mutable data
+    // that is read by other threads.
+    struct alignas(CACHELINE_SIZE) Shard
+    {
+      MessageQueue queue;
+    };
+
+    Shard shards[REMOTE_QUEUE_SHARDS];
+
+    MessageQueue& message_queue(size_t shard)
+    {
+      return shards[shard].queue;
+    }
+
+    /**
+     * The queue that the allocator with id `sender` posts to.  Allocator ids
+     * are aligned to the size of an allocator, so the id is hashed to spread
+     * senders over the shards.
+     */
+    MessageQueue& message_queue_for(alloc_id_t sender)
+    {
+      uint64_t h = static_cast<uint64_t>(sender) * 0x9E3779B97F4A7C15;
+      return message_queue(static_cast<size_t>(h >> 32) % REMOTE_QUEUE_SHARDS);
+    }
 
     alloc_id_t trunc_id()
     {
       return static_cast<alloc_id_t>(
-               reinterpret_cast<uintptr_t>(&message_queue)) &
+               reinterpret_cast<uintptr_t>(&shards[0].queue)) &
         ~SIZECLASS_MASK;
     }
   };
@@ -154,19 +176,69 @@ namespace snmalloc
     }
   };
 
+  /**
+   * Divides `REMOTE_CACHE_SHARED` between the remote caches of the allocators
+   * that threads are using.  Allocators count themselves in when they are
+   * acquired from the pool and out when they are released.
+   */
+  class RemoteCacheShare
+  {
+    inline static std::atomic<size_t> active{0};
+
+  public:
+    static void enter()
+    {
+      active.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void leave()
+    {
+      active.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * The most that each remote cache may hold while the number of
+     * allocators in use stays the same.
+     */
+    static int64_t share()
+    {
+      auto n = static_cast<int64_t>(
+        bits::max<size_t>(active.load(std::memory_order_relaxed), 1));
+      return bits::min(
+        REMOTE_CACHE, bits::max(REMOTE_CACHE_MIN, REMOTE_CACHE_SHARED / n));
+    }
+  };
+
   struct RemoteCache
   {
     /**
      * The total amount of memory we are waiting for before we will dispatch
      * to other allocators. Zero or negative mean we should dispatch on the
-     * next remote deallocation. This is initialised to the 0 so that we
-     * always hit a slow path to start with, when we hit the slow path and
-     * need to dispatch everything, we can check if we are a real allocator
-     * and lazily provide a real allocator.
+     * next remote deallocation. This is 0 in the placeholder allocator, which
+     * is zero-initialised, so that we always hit a slow path to start with,
+     * when we hit the slow path and need to dispatch everything, we can check
+     * if we are a real allocator and lazily provide a real allocator.  A real
+     * allocator starts with an empty cache, at `limit`.
      */
     int64_t capacity{0};
+
+    /**
+     * The capacity the cache is given each time it is posted, which the
+     * owning allocator adapts to its rate of remote deallocations.
+     */
+    int64_t limit{REMOTE_CACHE};
     std::array<RemoteList, REMOTE_SLOTS> list{};
 
+    /**
+     * Returns true if nothing has been added since the cache was created or
+     * last posted.  This holds for the placeholder allocator, whose capacity
+     * and limit are both zero.
+     */
+    bool is_empty()
+    {
+      return capacity >= limit;
+    }
+
     /// Used to find the index into the array of queues for remote
     /// deallocation
     /// r is used for which round of sending this is.
@@ -183,8 +255,11 @@ namespace snmalloc
       return (id >> (initial_shift + (r * REMOTE_SLOT_BITS))) & REMOTE_MASK;
     }
 
+    /**
+     * Add an object to the cache.  Returns the slot it was added to.
+     */
     template<typename Alloc>
-    SNMALLOC_FAST_PATH void dealloc(
+    SNMALLOC_FAST_PATH size_t dealloc(
       Remote::alloc_id_t target_id,
       CapPtr<void, CBAlloc> p,
       sizeclass_t sizeclass)
@@ -194,16 +269,18 @@ namespace snmalloc
 
       r->set_info(target_id, sizeclass);
 
-      RemoteList* l = &list[get_slot<Alloc>(target_id, 0)];
+      size_t slot = get_slot<Alloc>(target_id, 0);
+      RemoteList* l = &list[slot];
       l->last->non_atomic_next = r;
       l->last = r;
+      return slot;
     }
 
     template<typename Alloc>
     void post(Alloc* allocator, Remote::alloc_id_t id)
     {
       // When the cache gets big, post lists to their target allocators.
-      capacity = REMOTE_CACHE;
+      capacity = limit;
 
       size_t post_round = 0;
 
@@ -225,14 +302,19 @@ namespace snmalloc
             auto first_auth =
               allocator->large_allocator.template capptr_amplify<Remote>(first);
             auto super = Superslab::get(first_auth);
-            super->get_allocator()->message_queue.enqueue(first, l->last);
+            super->get_allocator()->message_queue_for(id).enqueue(
+              first, l->last);
             l->clear();
           }
         }
 
         RemoteList* resend = &list[my_slot];
         if (resend->empty())
+        {
+          allocator->counters().remote_post_rounds[bits::min(
+            post_round, NUM_POST_ROUND_BUCKETS - 1)] += 1;
           break;
+        }
 
         // Entries could map back onto the "resend" list,
         // so take copy of the head, mark the last element,
@@ -33,7 +33,7 @@ namespace snmalloc
     friend DLList<Superslab, CapPtrCBChunk>;
 
     // Keep the allocator pointer on a separate cache line. It is read by
-    // other threads, and does not change, so we avoid false sharing.
+    // other threads, and rarely changes, so we avoid false sharing.
     alignas(CACHELINE_SIZE)
       // The superslab is kept on a doubly linked list of superslabs which
       // have some space.
@@ -120,7 +120,7 @@ namespace snmalloc
 
     void init(RemoteAllocator* alloc)
     {
-      allocator = alloc;
+      set_allocator(alloc);
 
       // If Superslab is larger than a page, then we cannot guarantee it still
       // has a valid layout as the subsequent pages could have been freed and
@@ -170,6 +170,23 @@ namespace snmalloc
       return (used == (((SLAB_COUNT - 1) << 1) + 1));
     }
 
+    /**
+     * Returns true if `m` is the metadata of this superslab's short slab.
+     */
+    template<SNMALLOC_CONCEPT(capptr_bounds::c) B>
+    bool is_short_meta(CapPtr<Metaslab, B> m)
+    {
+      return address_cast(m) == address_cast(&meta[0]);
+    }
+
+    /**
+     * The number of slabs in use, counting the short slab as one.
+     */
+    size_t slabs_in_use()
+    {
+      return static_cast<size_t>(used >> 1) + (used & 1);
+    }
+
     bool is_almost_full()
     {
       return (used >= ((SLAB_COUNT - 1) << 1));
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "../ds/helpers.h"
+#include "../ds/mpmcstack.h"
+#include "threadalloc.h"
+
+namespace snmalloc
+{
+  /**
+   * Per-thread allocators for allocation tags.
+   *
+   * Tag 0 is the thread's ordinary allocator.  Each other tag that a thread
+   * allocates with gets an allocator of its own, so the tag of a small or
+   * medium object is the tag of the allocator that owns its slab, and needs
+   * no per-object header.  Objects can be freed with the ordinary `dealloc`
+   * from any thread.
+   *
+   * When a thread exits, its tagged allocators are kept for threads that
+   * later allocate with the same tag.  They are never returned to the
+   * general pool, where a thread could reuse one with live objects of a
+   * different tag.
+   */
+  class TaggedThreadAlloc
+  {
+    /**
+     * Allocators released by exited threads, by tag.
+     */
+    inline static MPMCStack<Alloc, PreZeroed> released[NUM_ALLOC_TAGS];
+
+    /**
+     * This thread's tagged allocators.  Entry 0 is unused.
+     */
+    static Alloc** allocs()
+    {
+      static thread_local Alloc* per_thread[NUM_ALLOC_TAGS] = {nullptr};
+      return per_thread;
+    }
+
+    /**
+     * Set once this thread's tagged allocators have been released, after
+     * which tagged allocations fall back to the ordinary allocator.
+     */
+    inline static thread_local bool destructor_has_run = false;
+
+    static void release_all()
+    {
+      auto* per_thread = allocs();
+      for (size_t i = 1; i < NUM_ALLOC_TAGS; i++)
+      {
+        auto* a = per_thread[i];
+        if (a != nullptr)
+        {
+          a->reclaim();
+          a->reset_in_use();
+          released[i].push(a);
+          RemoteCacheShare::leave();
+          per_thread[i] = nullptr;
+        }
+      }
+      destructor_has_run = true;
+    }
+
+    static SNMALLOC_SLOW_PATH Alloc* acquire(alloc_tag_t tag)
+    {
+      static thread_local OnDestruct<release_all> tidier;
+      UNUSED(tidier);
+
+      Alloc* a = released[tag].pop();
+      if (a != nullptr)
+      {
+        RemoteCacheShare::enter();
+        a->set_in_use();
+      }
+      else
+      {
+        a = current_alloc_pool()->acquire_new();
+        a->set_tag(tag);
+      }
+
+      allocs()[tag] = a;
+      return a;
+    }
+
+  public:
+    /**
+     * Returns this thread's allocator for `tag`, creating it if necessary.
+     */
+    static SNMALLOC_FAST_PATH Alloc* get(alloc_tag_t tag)
+    {
+      SNMALLOC_ASSERT(tag < NUM_ALLOC_TAGS);
+
+      if ((tag == 0) || unlikely(destructor_has_run))
+        return ThreadAlloc::get();
+
+      auto* a = allocs()[tag];
+      if (likely(a != nullptr))
+        return a;
+
+      return acquire(tag);
+    }
+
+    /**
+     * Flush the remote caches of this thread's tagged allocators and process
+     * the objects returned to them.
+     */
+    static void flush()
+    {
+      if (destructor_has_run)
+        return;
+
+      auto* per_thread = allocs();
+      for (size_t i = 1; i < NUM_ALLOC_TAGS; i++)
+      {
+        if (per_thread[i] != nullptr)
+          per_thread[i]->flush();
+      }
+    }
+
+    /**
+     * The bytes allocated by this thread's tagged allocators.  See
+     * `Allocator::allocated_bytes_ptr`.
+     */
+    static uint64_t allocated_bytes()
+    {
+      uint64_t total = 0;
+      auto* per_thread = allocs();
+      for (size_t i = 1; i < NUM_ALLOC_TAGS; i++)
+      {
+        if (per_thread[i] != nullptr)
+          total += *per_thread[i]->allocated_bytes_ptr();
+      }
+      return total;
+    }
+
+    /**
+     * The bytes freed through this thread's tagged allocators.
+     */
+    static uint64_t deallocated_bytes()
+    {
+      uint64_t total = 0;
+      auto* per_thread = allocs();
+      for (size_t i = 1; i < NUM_ALLOC_TAGS; i++)
+      {
+        if (per_thread[i] != nullptr)
+          total += *per_thread[i]->deallocated_bytes_ptr();
+      }
+      return total;
+    }
+  };
+} // namespace snmalloc
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../ds/address.h"
+#include "largealloc.h"
+#include "pagemap.h"
+
+namespace snmalloc
+{
+  /**
+   * Allocation tags let a program attribute its heap to subsystems.  Every
+   * allocator has a tag, fixed when it is first used, and small and medium
+   * objects are attributed to the tag of the allocator that owns their slab.
+   * Large allocations are not owned by an allocator once freed, so their
+   * tag is recorded in the tagmap below.
+   */
+  using alloc_tag_t = uint8_t;
+
+#ifndef SNMALLOC_NUM_ALLOC_TAGS
+#  define SNMALLOC_NUM_ALLOC_TAGS 16
+#endif
+  static constexpr size_t NUM_ALLOC_TAGS = SNMALLOC_NUM_ALLOC_TAGS;
+  static_assert(
+    NUM_ALLOC_TAGS <= (UINT8_MAX + 1), "Tags must fit in an alloc_tag_t");
+
+  /*
+   * Most chunks are never the start of a tagged large allocation, so use the
+   * tree pagemap unless the flat one would be no bigger than a single node.
+   */
+  using TagmapPagemap = std::conditional_t<
+    sizeof(FlatPagemap<SUPERSLAB_BITS, alloc_tag_t>) <= PAGEMAP_NODE_SIZE,
+    FlatPagemap<SUPERSLAB_BITS, alloc_tag_t>,
+    Pagemap<SUPERSLAB_BITS, alloc_tag_t, 0, DefaultPrimAlloc>>;
+
+  struct ForTagmap
+  {};
+  using GlobalTagmap = GlobalPagemapTemplate<TagmapPagemap, ForTagmap>;
+
+  /**
+   * Map from the first chunk of a large allocation to the tag of the
+   * allocator that allocated it.  Only non-zero tags are stored, and an entry
+   * is cleared when the allocation is freed.  Until the first tag is stored,
+   * lookups return 0 without reading the map, so untagged programs neither
+   * write nor read it.
+   */
+  struct Tagmap
+  {
+  private:
+    inline static std::atomic<bool> used{false};
+
+  public:
+    static alloc_tag_t get(address_t p)
+    {
+      if (!used.load(std::memory_order_relaxed))
+        return 0;
+
+      return GlobalTagmap::pagemap().get(p);
+    }
+
+    static void set(address_t p, alloc_tag_t tag)
+    {
+      // The allocation is published to other threads after this, so they
+      // see the flag before they can free it.
+      if ((tag != 0) && !used.load(std::memory_order_relaxed))
+        used.store(true, std::memory_order_relaxed);
+
+      GlobalTagmap::pagemap().set(p, tag);
+    }
+  };
+} // namespace snmalloc
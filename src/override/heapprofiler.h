@@ -0,0 +1,189 @@
+#pragma once
+
+#include "../snmalloc.h"
+#include "output.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  define SNMALLOC_HEAP_PROFILE_DUMP
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+/**
+ * Control and output for the sampling heap profiler in `mem/heapprofile.h`.
+ *
+ * Profiles are written in the text format of the gperftools heap profiler,
+ * which `pprof` reads.  Each stack reports both its live allocations and
+ * everything allocated from it since profiling started (or was last reset),
+ * so `pprof -inuse_space` and `pprof -alloc_space` give the live and
+ * cumulative profiles from a single dump.
+ *
+ * The profiler can be controlled through `mallctl` (`prof.active`,
+ * `prof.dump`, `prof.reset`) or, through the malloc shim, from the
+ * environment:
+ *
+ *  - `SNMALLOC_HEAP_PROFILE`: start profiling, and write a profile to this
+ *    path when the process exits.
+ *  - `SNMALLOC_HEAP_PROFILE_INTERVAL`: the mean number of bytes between
+ *    samples, 512 KiB by default.
+ */
+namespace snmalloc
+{
+  class HeapProfiler
+  {
+    /**
+     * Path that a profile is written to at exit.
+     */
+    inline static const char* exit_path = nullptr;
+
+    static void dump_at_exit()
+    {
+      dump(exit_path);
+    }
+
+    /**
+     * Copy the memory map of the process, which `pprof` uses to symbolise
+     * the addresses in the profile.
+     */
+    static void write_mappings(FdOutput& out)
+    {
+#ifdef SNMALLOC_HEAP_PROFILE_DUMP
+      int maps = ::open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+      if (maps < 0)
+        return;
+
+      char buffer[1024];
+      ssize_t n;
+      while ((n = ::read(maps, buffer, sizeof(buffer))) > 0)
+      {
+        for (ssize_t i = 0; i < n; i++)
+          out << buffer[i];
+      }
+      ::close(maps);
+#else
+      UNUSED(out);
+#endif
+    }
+
+  public:
+    /**
+     * Start or stop sampling.  Returns 0, or an errno value if the profiler
+     * could not be started.
+     */
+    static int activate(bool on)
+    {
+      if (!HeapProfile::set_active(on))
+        return ENOMEM;
+
+      current_alloc_pool()->reschedule_samples();
+      return 0;
+    }
+
+    /**
+     * Write a profile to `fd`.
+     */
+    static void write(int fd)
+    {
+      FdOutput out(fd);
+
+      size_t live_objects = 0;
+      size_t live_bytes = 0;
+      size_t objects = 0;
+      size_t bytes = 0;
+      HeapProfile::for_each_bucket([&](HeapProfile::Bucket& b) {
+        live_objects += b.allocs - b.frees;
+        live_bytes += b.alloc_bytes - b.free_bytes;
+        objects += b.allocs;
+        bytes += b.alloc_bytes;
+      });
+
+      out << "heap profile: " << live_objects << ": " << live_bytes << " ["
+          << objects << ": " << bytes
+          << "] @ heap_v2/" << HeapProfile::get_interval() << "\n";
+
+      HeapProfile::for_each_bucket([&out](HeapProfile::Bucket& b) {
+        if (b.allocs == 0)
+          return;
+
+        out << (b.allocs - b.frees) << ": " << (b.alloc_bytes - b.free_bytes)
+            << " [" << b.allocs << ": " << b.alloc_bytes << "] @";
+        for (size_t i = 0; i < b.depth; i++)
+          out << " " << static_cast<const void*>(b.frames[i]);
+        out << "\n";
+      });
+
+      out << "\nMAPPED_LIBRARIES:\n";
+      write_mappings(out);
+    }
+
+    /**
+     * Write a profile to the file at `path`, replacing it if it exists.
+     * Returns 0 or an errno value.
+     */
+    static int dump(const char* path)
+    {
+#ifdef SNMALLOC_HEAP_PROFILE_DUMP
+      if (path == nullptr)
+        return EINVAL;
+
+      int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0)
+        return errno;
+
+      write(fd);
+      ::close(fd);
+      return 0;
+#else
+      UNUSED(path);
+      return ENOSYS;
+#endif
+    }
+
+    /**
+     * Start the profiler if it is configured in the environment.  Returns
+     * true if it was started.  This allocates and registers an `atexit`
+     * handler, so the malloc shim calls it through
+     * `defer_start_from_environment`.
+     */
+    static bool start_from_environment()
+    {
+      const char* interval = getenv("SNMALLOC_HEAP_PROFILE_INTERVAL");
+      if (interval != nullptr)
+      {
+        size_t bytes = strtoull(interval, nullptr, 10);
+        if (bytes != 0)
+          HeapProfile::set_interval(bytes);
+      }
+
+      const char* path = getenv("SNMALLOC_HEAP_PROFILE");
+      if ((path == nullptr) || (*path == '\0'))
+        return false;
+
+      if (activate(true) != 0)
+        return false;
+
+      exit_path = path;
+      atexit(&dump_at_exit);
+      return true;
+    }
+
+    /**
+     * Arrange for `start_from_environment` to run after the next allocation,
+     * if the profiler is configured in the environment.  This is safe to
+     * call from a static initialiser.  Returns true if the profiler is
+     * configured.
+     */
+    static bool defer_start_from_environment()
+    {
+      const char* path = getenv("SNMALLOC_HEAP_PROFILE");
+      if ((path == nullptr) || (*path == '\0'))
+        return false;
+
+      current_alloc_pool()->defer([]() { start_from_environment(); });
+      return true;
+    }
+  };
+} // namespace snmalloc
@@ -0,0 +1,872 @@
+#pragma once
+
+#include "../snmalloc.h"
+#include "heapprofiler.h"
+
+#include <errno.h>
+#include <string.h>
+
+/**
+ * A jemalloc-compatible `mallctl` namespace.
+ *
+ * This exposes snmalloc's statistics and a few control operations under the
+ * names that jemalloc uses, so that tooling written against jemalloc's
+ * `mallctl` interface can be pointed at snmalloc.  snmalloc has a single
+ * logical arena, so arena index 0 and `MALLCTL_ARENAS_ALL` (4096) both refer
+ * to the whole heap.
+ *
+ * The supported names are:
+ *
+ *  - `version` (`const char*`)
+ *  - `epoch` (`uint64_t`, read-write).  Statistics are computed when read, so
+ *    writing the epoch only advances the counter.
+ *  - `stats.allocated`, `stats.active`, `stats.resident`, `stats.mapped`,
+ *    `stats.retained` (`size_t`)
+ *  - `arenas.narenas`, `arenas.nbins`, `arenas.nlextents`, `arenas.ntags`
+ *    (`unsigned`)
+ *  - `arenas.bin.<j>.size`, `arenas.lextent.<j>.size` (`size_t`)
+ *  - `stats.arenas.<i>.bins.<j>.{nmalloc,ndalloc,curregs,curslabs}` and
+ *    `stats.arenas.<i>.lextents.<j>.{nmalloc,ndalloc,curlextents}`
+ *    (`uint64_t` / `size_t`)
+ *  - `opt.dirty_decay_ms`, `opt.muzzy_decay_ms`, `arenas.dirty_decay_ms`,
+ *    `arenas.muzzy_decay_ms`, `arena.<i>.dirty_decay_ms`,
+ *    `arena.<i>.muzzy_decay_ms` (`ssize_t`, read-only).  These report 0 if
+ *    freed chunks are decommitted immediately and -1 otherwise.
+ *  - `stats.tags.<t>.live` (`size_t`): bytes in live allocations made with
+ *    allocation tag `t`.  This is not a jemalloc name.
+ *  - `stats.remote.cached`, `stats.remote.queued` (`size_t`): bytes freed
+ *    by threads that do not own them, which are waiting in the freeing
+ *    allocators' remote caches, or in the owners' message queues.  These
+ *    are not jemalloc names.
+ *  - `stats.remote.slots`, `stats.remote.nallocators` (`unsigned`), and
+ *    `stats.remote.allocator.<i>.slot` (`unsigned`) and
+ *    `stats.remote.allocator.<i>.sent.<s>` (`uint64_t`): the number of
+ *    objects that the `i`th allocator has freed remotely through slot `s`
+ *    of its remote cache.  Objects are sent through the slot of their
+ *    owner, so reading `slot` for every allocator turns these into a matrix
+ *    of remote free traffic between allocators, though allocators that
+ *    share a slot cannot be told apart.  Allocator indices are only stable
+ *    while no allocators are being created.  These are not jemalloc names.
+ *  - `stats.remote.forwarded` (`uint64_t`): objects that arrived at an
+ *    allocator that shares a slot with their owner, and were forwarded on.
+ *  - `stats.remote.rounds.<r>` (`uint64_t`): the number of times a remote
+ *    cache was posted in `r + 1` rounds, the last of
+ *    `NUM_POST_ROUND_BUCKETS` buckets also counting longer posts.  Each
+ *    round after the first resends objects in the poster's own slot.
+ *  - `stats.heap.dump` (`const char*`, write-only): write a `HeapReport` of
+ *    where the heap's memory is, by sizeclass, to the given path as JSON.
+ *    This is not a jemalloc name.
+ *  - `experimental.utilization.query` (`const void*` in, `SlabUtilization`
+ *    out): how full the slab holding the given object is, and how full the
+ *    slabs of its sizeclass are, in the calling thread's allocator.  See
+ *    `Allocator::utilization`.
+ *  - `stats.latency.active` (`bool`, read-write): record the latency of the
+ *    allocator's slow paths.  This is off by default.
+ *  - `stats.latency.nbuckets` (`unsigned`), and
+ *    `stats.latency.<path>.<b>` (`uint64_t`): the number of calls to slow
+ *    path `path` that took between 2^(b-1) and 2^b ticks, where `path` is
+ *    one of `small_alloc_rare`, `alloc_slab`, `medium_slab`, `large_alloc`,
+ *    `remote_dealloc`, `message_queue` and `reserve`.  These are not
+ *    jemalloc names.
+ *  - `thread.tcache.flush`: send this thread's cached remote deallocations
+ *    to their owners and process any it has received, for its ordinary and
+ *    tagged allocators.
+ *  - `thread.allocated`, `thread.deallocated` (`uint64_t`): the bytes
+ *    allocated and freed by the calling thread, with its ordinary and
+ *    tagged allocators, rounded up to the sizeclass.  A free is counted by
+ *    the thread that performs it, even if another thread allocated the
+ *    object.
+ *  - `thread.allocatedp`, `thread.deallocatedp` (`uint64_t*`): the same
+ *    totals for the thread's ordinary allocator only.  The pointers stay
+ *    valid while the thread runs, so the totals can be sampled with a single
+ *    load.
+ *  - `arena.<i>.purge`, `arena.<i>.decay`: return the memory of unused
+ *    cached chunks to the OS.
+ *  - `opt.prof` (`bool`): whether the heap profiler is available.
+ *  - `prof.active` (`bool`, read-write): start or stop sampling.
+ *  - `prof.dump` (`const char*`, write-only): write a heap profile to the
+ *    given path.  Unlike jemalloc, a path must be given.
+ *  - `prof.reset` (`size_t`, write-only): discard the cumulative profile and,
+ *    if a value is written, set the sampling interval to 2^value bytes.
+ *  - `prof.lg_sample` (`size_t`): the sampling interval, rounded down to a
+ *    power of two.
+ *
+ * Most values come from the always-on `AllocCounters`.  Exact counts of
+ * small objects need the allocator to be built with `USE_SNMALLOC_STATS`.
+ * Without it, `stats.allocated` counts small allocations at slab
+ * granularity, like `stats.active`, and the small bins report `nmalloc` as
+ * the number of objects made available to the fast path and have no
+ * `ndalloc` or `curregs`.
+ */
+namespace snmalloc::mallctl
+{
+  /**
+   * The arena index that jemalloc uses to mean all arenas.
+   */
+  static constexpr size_t ARENAS_ALL = 4096;
+
+  /**
+   * Cursor over the dot-separated components of a mallctl name.
+   *
+   * Each method consumes nothing unless it succeeds, but a chain of them can
+   * fail part way through.  Once a lookup has consumed a component, it must
+   * either resolve the name or fail, rather than let a later alternative
+   * start from the middle of the name.  Leaves are matched with `is`, which
+   * matches the rest of the name at once.
+   */
+  class Name
+  {
+    const char* cursor;
+
+    /**
+     * Step over the separator after a component.  Returns false if the
+     * component was not followed by a separator or the end of the name.
+     */
+    bool end_component(const char* next)
+    {
+      if (*next == '.')
+        next++;
+      else if (*next != '\0')
+        return false;
+
+      cursor = next;
+      return true;
+    }
+
+  public:
+    Name(const char* name) : cursor(name) {}
+
+    /**
+     * Consume the next component if it is `component`.
+     */
+    bool match(const char* component)
+    {
+      size_t len = strlen(component);
+      if (strncmp(cursor, component, len) != 0)
+        return false;
+
+      return end_component(cursor + len);
+    }
+
+    /**
+     * Consume the rest of the name if it is exactly `rest`, which may span
+     * several components.
+     */
+    bool is(const char* rest)
+    {
+      if (strcmp(cursor, rest) != 0)
+        return false;
+
+      cursor += strlen(rest);
+      return true;
+    }
+
+    /**
+     * Consume the next component if it is a decimal number, storing it in
+     * `index`.
+     */
+    bool index(size_t& index)
+    {
+      const char* next = cursor;
+      size_t value = 0;
+
+      if ((*next < '0') || (*next > '9'))
+        return false;
+
+      while ((*next >= '0') && (*next <= '9'))
+      {
+        value = (value * 10) + static_cast<size_t>(*next - '0');
+        if (value > ARENAS_ALL)
+          return false;
+        next++;
+      }
+
+      if (!end_component(next))
+        return false;
+
+      index = value;
+      return true;
+    }
+
+    /**
+     * Consume the next component if it is a valid arena index.
+     */
+    bool arena()
+    {
+      size_t i;
+      return index(i) && ((i == 0) || (i == ARENAS_ALL));
+    }
+
+    /**
+     * Returns true if every component has been consumed.
+     */
+    bool done()
+    {
+      return *cursor == '\0';
+    }
+  };
+
+  /**
+   * Copy `value` out to the caller, following jemalloc's convention that a
+   * mismatched length copies what fits and reports `EINVAL`.
+   */
+  template<typename T>
+  int copy_out(void* oldp, size_t* oldlenp, T value)
+  {
+    if ((oldp == nullptr) || (oldlenp == nullptr))
+      return 0;
+
+    // Copy at most the caller's length on every path, so that the compiler
+    // can see the copy is bounded by it.
+    size_t len = bits::min(*oldlenp, sizeof(T));
+    memcpy(oldp, &value, len);
+    if ((len == *oldlenp) && (len == sizeof(T)))
+      return 0;
+
+    *oldlenp = len;
+    return EINVAL;
+  }
+
+  /**
+   * Report a read-only value.
+   */
+  template<typename T>
+  int read_only(void* oldp, size_t* oldlenp, void* newp, size_t newlen, T value)
+  {
+    if ((newp != nullptr) || (newlen != 0))
+      return EPERM;
+
+    return copy_out(oldp, oldlenp, value);
+  }
+
+  /**
+   * Perform an operation that neither reads nor writes a value.
+   */
+  template<typename F>
+  int command(void* oldp, size_t* oldlenp, void* newp, size_t newlen, F f)
+  {
+    if (
+      (oldp != nullptr) || ((oldlenp != nullptr) && (*oldlenp != 0)) ||
+      (newp != nullptr) || (newlen != 0))
+      return EPERM;
+
+    f();
+    return 0;
+  }
+
+  /**
+   * Statistics aggregated over every allocator in the pool.
+   */
+  inline Stats aggregate_stats()
+  {
+    Stats stats;
+    current_alloc_pool()->aggregate_stats(stats);
+    return stats;
+  }
+
+  /**
+   * Always-on counters aggregated over every allocator in the pool.
+   */
+  inline AllocCounterTotals aggregate_counters()
+  {
+    AllocCounterTotals totals;
+    current_alloc_pool()->aggregate_counters(totals);
+    return totals;
+  }
+
+  /**
+   * Write a `HeapReport` to `path` as JSON.  Returns 0 or an errno value.
+   */
+  inline int dump_heap_report(const char* path)
+  {
+#if defined(SNMALLOC_HEAP_PROFILE_DUMP) && !defined(SNMALLOC_PASS_THROUGH)
+    if (path == nullptr)
+      return EINVAL;
+
+    HeapReport report;
+    current_alloc_pool()->heap_report(report, ThreadAlloc::get_noncachable());
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return errno;
+
+    {
+      FdOutput out(fd);
+      report.write_json(out);
+    }
+    ::close(fd);
+    return 0;
+#else
+    UNUSED(path);
+    return ENOSYS;
+#endif
+  }
+
+  /**
+   * Bytes of memory obtained from the OS that are not cached for reuse.
+   */
+  inline size_t resident_bytes()
+  {
+    return default_memory_provider().memory_usage().first;
+  }
+
+  /**
+   * Bytes in small slabs that contain at least one live allocation, and in
+   * medium and large allocations.
+   */
+  inline size_t active_bytes()
+  {
+    return aggregate_counters().active_bytes();
+  }
+
+  /**
+   * Bytes in live allocations.  Without `USE_SNMALLOC_STATS`, small
+   * allocations are counted at slab granularity.
+   */
+  inline size_t allocated_bytes()
+  {
+#ifdef USE_SNMALLOC_STATS
+    auto stats = aggregate_stats();
+    size_t total = aggregate_counters().medium_and_large_bytes();
+
+    for (sizeclass_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      total += stats.sizeclass[i].count.current * sizeclass_to_size(i);
+
+    return total;
+#else
+    return active_bytes();
+#endif
+  }
+
+  /**
+   * Bytes in live allocations made with allocation tag `tag`, rounded up to
+   * the sizeclass.  Objects freed by another thread are counted until their
+   * owner processes the free.
+   */
+  inline size_t tag_live_bytes(size_t tag)
+  {
+    int64_t live[NUM_ALLOC_TAGS] = {0};
+    current_alloc_pool()->aggregate_tag_bytes(live);
+    // Counters read while other threads run may be briefly inconsistent.
+    return (live[tag] < 0) ? 0 : static_cast<size_t>(live[tag]);
+  }
+
+  /**
+   * The decay time that jemalloc would report for the configured decommit
+   * strategy.
+   */
+  inline ptrdiff_t decay_ms()
+  {
+    return (decommit_strategy == DecommitSuper) ? 0 : -1;
+  }
+
+  /**
+   * The epoch, advanced by writes to `epoch`.
+   */
+  inline std::atomic<uint64_t>& epoch()
+  {
+    static std::atomic<uint64_t> e{1};
+    return e;
+  }
+
+  inline int
+  ctl_epoch(void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (newp != nullptr)
+    {
+      if (newlen != sizeof(uint64_t))
+        return EINVAL;
+      epoch()++;
+    }
+
+    return copy_out(oldp, oldlenp, epoch().load());
+  }
+
+  /**
+   * Per-sizeclass counters.  Medium sizeclasses and small slab counts come
+   * from the always-on counters.  Small object counts need
+   * `USE_SNMALLOC_STATS`; without it `nmalloc` counts the objects made
+   * available to the fast path, and `ndalloc` and `curregs` are not present.
+   */
+  inline int ctl_stats_bin(
+    Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    size_t j;
+    if (!name.index(j) || (j >= NUM_SIZECLASSES))
+      return ENOENT;
+
+    auto counters = aggregate_counters();
+
+    if (j >= NUM_SMALL_CLASSES)
+    {
+      size_t m = j - NUM_SMALL_CLASSES;
+      size_t nmalloc = counters.medium_allocated[m];
+      size_t ndalloc = counters.medium_deallocated[m];
+
+      if (name.is("nmalloc"))
+        return read_only<uint64_t>(oldp, oldlenp, newp, newlen, nmalloc);
+      if (name.is("ndalloc"))
+        return read_only<uint64_t>(oldp, oldlenp, newp, newlen, ndalloc);
+      if (name.is("curregs"))
+        return read_only<size_t>(
+          oldp, oldlenp, newp, newlen, nmalloc - ndalloc);
+      return ENOENT;
+    }
+
+    if (name.is("curslabs"))
+      return read_only<size_t>(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        counters.small_slabs_allocated[j] - counters.small_slabs_deallocated[j]);
+
+#ifdef USE_SNMALLOC_STATS
+    auto stats = aggregate_stats();
+    auto& s = stats.sizeclass[j];
+
+    if (name.is("nmalloc"))
+      return read_only<uint64_t>(oldp, oldlenp, newp, newlen, s.count.used);
+    if (name.is("ndalloc"))
+      return read_only<uint64_t>(
+        oldp, oldlenp, newp, newlen, s.count.used - s.count.current);
+    if (name.is("curregs"))
+      return read_only<size_t>(oldp, oldlenp, newp, newlen, s.count.current);
+#else
+    if (name.is("nmalloc"))
+      return read_only<uint64_t>(
+        oldp, oldlenp, newp, newlen, counters.small_refilled[j]);
+#endif
+    return ENOENT;
+  }
+
+  inline int ctl_stats_lextent(
+    Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    size_t j;
+    if (!name.index(j) || (j >= NUM_LARGE_CLASSES))
+      return ENOENT;
+
+    auto counters = aggregate_counters();
+    size_t nmalloc = counters.large_allocated[j];
+    size_t ndalloc = counters.large_deallocated[j];
+
+    if (name.is("nmalloc"))
+      return read_only<uint64_t>(oldp, oldlenp, newp, newlen, nmalloc);
+    if (name.is("ndalloc"))
+      return read_only<uint64_t>(oldp, oldlenp, newp, newlen, ndalloc);
+    if (name.is("curlextents"))
+      return read_only<size_t>(
+        oldp, oldlenp, newp, newlen, nmalloc - ndalloc);
+    return ENOENT;
+  }
+
+  inline int ctl_stats_latency(
+    Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (name.is("active"))
+    {
+      bool old = LatencyTimer::is_enabled();
+      if (newp != nullptr)
+      {
+        if (newlen != sizeof(bool))
+          return EINVAL;
+        LatencyTimer::enable(*static_cast<bool*>(newp));
+      }
+      return copy_out(oldp, oldlenp, old);
+    }
+
+    if (name.is("nbuckets"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        static_cast<unsigned>(NUM_LATENCY_BUCKETS));
+
+    for (size_t path = 0; path < NUM_SLOW_PATHS; path++)
+    {
+      size_t b;
+      if (name.match(slow_path_name(path)))
+      {
+        if (name.index(b) && (b < NUM_LATENCY_BUCKETS) && name.done())
+          return read_only<uint64_t>(
+            oldp, oldlenp, newp, newlen, aggregate_counters().latency[path][b]);
+        return ENOENT;
+      }
+    }
+
+    return ENOENT;
+  }
+
+  inline int
+  ctl_stats(Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (name.is("allocated"))
+      return read_only(oldp, oldlenp, newp, newlen, allocated_bytes());
+    if (name.is("active"))
+      return read_only(oldp, oldlenp, newp, newlen, active_bytes());
+    if (name.is("resident"))
+      return read_only(oldp, oldlenp, newp, newlen, resident_bytes());
+    if (name.is("mapped"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        default_memory_provider().memory_usage().second);
+    if (name.is("retained"))
+    {
+      auto usage = default_memory_provider().memory_usage();
+      return read_only(
+        oldp, oldlenp, newp, newlen, usage.second - usage.first);
+    }
+
+    if (name.match("arenas"))
+    {
+      if (!name.arena())
+        return ENOENT;
+      if (name.match("bins"))
+        return ctl_stats_bin(name, oldp, oldlenp, newp, newlen);
+      if (name.match("lextents"))
+        return ctl_stats_lextent(name, oldp, oldlenp, newp, newlen);
+      return ENOENT;
+    }
+
+    if (name.match("remote"))
+    {
+      if (name.is("slots"))
+        return read_only(
+          oldp, oldlenp, newp, newlen, static_cast<unsigned>(REMOTE_SLOTS));
+      if (name.is("nallocators"))
+        return read_only(
+          oldp,
+          oldlenp,
+          newp,
+          newlen,
+          static_cast<unsigned>(current_alloc_pool()->count_allocators()));
+      if (name.is("forwarded"))
+        return read_only<uint64_t>(
+          oldp, oldlenp, newp, newlen, aggregate_counters().remote_forwarded);
+
+      size_t i;
+      if (name.match("rounds"))
+      {
+        if (name.index(i) && (i < NUM_POST_ROUND_BUCKETS) && name.done())
+          return read_only<uint64_t>(
+            oldp,
+            oldlenp,
+            newp,
+            newlen,
+            aggregate_counters().remote_post_rounds[i]);
+        return ENOENT;
+      }
+
+      if (name.match("allocator"))
+      {
+        if (!name.index(i))
+          return ENOENT;
+
+        size_t slot;
+        AllocCounterTotals counters;
+        if (!current_alloc_pool()->allocator_counters(i, slot, counters))
+          return ENOENT;
+
+        if (name.is("slot"))
+          return read_only(
+            oldp, oldlenp, newp, newlen, static_cast<unsigned>(slot));
+
+        size_t s;
+        if (
+          name.match("sent") && name.index(s) && (s < REMOTE_SLOTS) &&
+          name.done())
+          return read_only<uint64_t>(
+            oldp, oldlenp, newp, newlen, counters.remote_sent[s]);
+        return ENOENT;
+      }
+
+      int64_t cached = 0;
+      int64_t queued = 0;
+      current_alloc_pool()->aggregate_remote_bytes(cached, queued);
+      if (name.is("cached"))
+        return read_only(
+          oldp,
+          oldlenp,
+          newp,
+          newlen,
+          static_cast<size_t>(bits::max<int64_t>(cached, 0)));
+      if (name.is("queued"))
+        return read_only(
+          oldp,
+          oldlenp,
+          newp,
+          newlen,
+          static_cast<size_t>(bits::max<int64_t>(queued, 0)));
+      return ENOENT;
+    }
+
+    if (name.match("latency"))
+      return ctl_stats_latency(name, oldp, oldlenp, newp, newlen);
+
+    if (name.is("heap.dump"))
+    {
+      if ((oldp != nullptr) || (oldlenp != nullptr))
+        return EPERM;
+      if ((newp == nullptr) || (newlen != sizeof(const char*)))
+        return EINVAL;
+      return dump_heap_report(*static_cast<const char**>(newp));
+    }
+
+    size_t tag;
+    if (name.match("tags"))
+    {
+      if (name.index(tag) && (tag < NUM_ALLOC_TAGS) && name.is("live"))
+        return read_only(oldp, oldlenp, newp, newlen, tag_live_bytes(tag));
+      return ENOENT;
+    }
+
+    return ENOENT;
+  }
+
+  inline int
+  ctl_arenas(Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    size_t j;
+
+    if (name.is("narenas"))
+      return read_only(oldp, oldlenp, newp, newlen, 1U);
+    if (name.is("nbins"))
+      return read_only(
+        oldp, oldlenp, newp, newlen, static_cast<unsigned>(NUM_SIZECLASSES));
+    if (name.is("nlextents"))
+      return read_only(
+        oldp, oldlenp, newp, newlen, static_cast<unsigned>(NUM_LARGE_CLASSES));
+    if (name.is("ntags"))
+      return read_only(
+        oldp, oldlenp, newp, newlen, static_cast<unsigned>(NUM_ALLOC_TAGS));
+
+    if (name.match("bin"))
+    {
+      if (name.index(j) && (j < NUM_SIZECLASSES) && name.is("size"))
+        return read_only(
+          oldp,
+          oldlenp,
+          newp,
+          newlen,
+          sizeclass_to_size(static_cast<sizeclass_t>(j)));
+      return ENOENT;
+    }
+
+    if (name.match("lextent"))
+    {
+      if (name.index(j) && (j < NUM_LARGE_CLASSES) && name.is("size"))
+        return read_only(
+          oldp,
+          oldlenp,
+          newp,
+          newlen,
+          large_sizeclass_to_size(static_cast<uint8_t>(j)));
+      return ENOENT;
+    }
+
+    if (name.is("dirty_decay_ms") || name.is("muzzy_decay_ms"))
+      return read_only(oldp, oldlenp, newp, newlen, decay_ms());
+
+    return ENOENT;
+  }
+
+  inline int
+  ctl_arena(Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (!name.arena())
+      return ENOENT;
+
+    if (name.is("purge") || name.is("decay"))
+    {
+      return command(oldp, oldlenp, newp, newlen, []() {
+        current_alloc_pool()->cleanup_unused();
+        default_memory_provider().purge();
+      });
+    }
+
+    if (name.is("dirty_decay_ms") || name.is("muzzy_decay_ms"))
+      return read_only(oldp, oldlenp, newp, newlen, decay_ms());
+
+    return ENOENT;
+  }
+
+  /**
+   * `thread.*`: operations on the calling thread's allocator.
+   */
+  inline int ctl_thread(
+    Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (name.is("tcache.flush"))
+    {
+      return command(oldp, oldlenp, newp, newlen, []() {
+        ThreadAlloc::get_noncachable()->flush();
+        TaggedThreadAlloc::flush();
+      });
+    }
+
+    if (name.is("allocatedp"))
+      return read_only(
+        oldp, oldlenp, newp, newlen, ThreadAlloc::get()->allocated_bytes_ptr());
+
+    if (name.is("deallocatedp"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        ThreadAlloc::get()->deallocated_bytes_ptr());
+
+    if (name.is("allocated"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        *ThreadAlloc::get()->allocated_bytes_ptr() +
+          TaggedThreadAlloc::allocated_bytes());
+
+    if (name.is("deallocated"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        *ThreadAlloc::get()->deallocated_bytes_ptr() +
+          TaggedThreadAlloc::deallocated_bytes());
+
+    return ENOENT;
+  }
+
+  /**
+   * `prof.*`: control of the sampling heap profiler.
+   */
+  inline int
+  ctl_prof(Name& name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+#ifndef SNMALLOC_PASS_THROUGH
+    if (name.is("active"))
+    {
+      bool was_active = HeapProfile::is_active();
+      if (newp != nullptr)
+      {
+        if (newlen != sizeof(bool))
+          return EINVAL;
+        int err = HeapProfiler::activate(*static_cast<bool*>(newp));
+        if (err != 0)
+          return err;
+      }
+      return copy_out(oldp, oldlenp, was_active);
+    }
+
+    if (name.is("dump"))
+    {
+      if ((oldp != nullptr) || (oldlenp != nullptr))
+        return EPERM;
+      if ((newp == nullptr) || (newlen != sizeof(const char*)))
+        return EINVAL;
+      return HeapProfiler::dump(*static_cast<const char**>(newp));
+    }
+
+    if (name.is("reset"))
+    {
+      if ((oldp != nullptr) || (oldlenp != nullptr))
+        return EPERM;
+      if (newp != nullptr)
+      {
+        if (newlen != sizeof(size_t))
+          return EINVAL;
+        size_t lg_sample = *static_cast<size_t*>(newp);
+        if (lg_sample >= bits::BITS)
+          return EINVAL;
+        HeapProfile::set_interval(bits::one_at_bit(lg_sample));
+      }
+      HeapProfile::reset();
+      return 0;
+    }
+
+    if (name.is("lg_sample"))
+      return read_only(
+        oldp,
+        oldlenp,
+        newp,
+        newlen,
+        bits::next_pow2_bits(HeapProfile::get_interval() + 1) - 1);
+#else
+    UNUSED(name);
+    UNUSED(oldp);
+    UNUSED(oldlenp);
+    UNUSED(newp);
+    UNUSED(newlen);
+#endif
+
+    return ENOENT;
+  }
+
+  /**
+   * Look up `name` and read and/or write its value, following the calling
+   * convention of jemalloc's `mallctl`.
+   */
+  inline int
+  ctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    if (name == nullptr)
+      return ENOENT;
+
+    Name n(name);
+
+    if (n.is("version"))
+      return read_only(oldp, oldlenp, newp, newlen, "snmalloc");
+
+    if (n.is("epoch"))
+      return ctl_epoch(oldp, oldlenp, newp, newlen);
+
+    if (n.match("stats"))
+      return ctl_stats(n, oldp, oldlenp, newp, newlen);
+
+    if (n.match("arenas"))
+      return ctl_arenas(n, oldp, oldlenp, newp, newlen);
+
+    if (n.match("arena"))
+      return ctl_arena(n, oldp, oldlenp, newp, newlen);
+
+    if (n.match("thread"))
+      return ctl_thread(n, oldp, oldlenp, newp, newlen);
+
+    if (n.match("prof"))
+      return ctl_prof(n, oldp, oldlenp, newp, newlen);
+
+    if (n.is("experimental.utilization.query"))
+    {
+      if ((newp == nullptr) || (newlen != sizeof(const void*)))
+        return EINVAL;
+      const void* p = *static_cast<const void**>(newp);
+      if (p == nullptr)
+        return EINVAL;
+      SlabUtilization u;
+      ThreadAlloc::get_noncachable()->utilization(p, u);
+      return copy_out(oldp, oldlenp, u);
+    }
+
+    if (n.match("opt"))
+    {
+      if (n.is("dirty_decay_ms") || n.is("muzzy_decay_ms"))
+        return read_only(oldp, oldlenp, newp, newlen, decay_ms());
+
+      if (n.is("prof"))
+      {
+#ifndef SNMALLOC_PASS_THROUGH
+        return read_only(oldp, oldlenp, newp, newlen, true);
+#else
+        return read_only(oldp, oldlenp, newp, newlen, false);
+#endif
+      }
+    }
+
+    return ENOENT;
+  }
+} // namespace snmalloc::mallctl
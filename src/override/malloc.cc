@@ -1,5 +1,9 @@
 #include "../mem/slowalloc.h"
 #include "../snmalloc.h"
+#include "heapprofiler.h"
+#include "mallctl.h"
+#include "statsexport.h"
+#include "trace.h"
 
 #include <errno.h>
 #include <string.h>
@@ -22,6 +26,82 @@ using namespace snmalloc;
 #  define MALLOC_USABLE_SIZE_QUALIFIER
 #endif
 
+// Flags for the jemalloc-compatible `*allocx` functions.  The encoding matches
+// jemalloc's, so callers built against jemalloc's headers work unmodified.
+// Only the alignment and zeroing flags are meaningful to snmalloc; the thread
+// cache and arena selection flags are accepted and ignored.
+#ifndef MALLOCX_LG_ALIGN
+#  define MALLOCX_LG_ALIGN(la) ((int)(la))
+#  define MALLOCX_ALIGN(a) ((int)snmalloc::bits::ctz(a))
+#  define MALLOCX_ZERO ((int)0x40)
+#  define MALLOCX_TCACHE(tc) ((int)(((tc) + 2) << 8))
+#  define MALLOCX_TCACHE_NONE MALLOCX_TCACHE(-1)
+#  define MALLOCX_ARENA(a) ((((int)(a)) + 1) << 20)
+#endif
+
+namespace
+{
+  /**
+   * Mask of the bits in an `*allocx` flags word that hold the log2 of the
+   * requested alignment.
+   */
+  constexpr int MALLOCX_LG_ALIGN_MASK = 0x3f;
+
+  /**
+   * Convert a size and the flags passed to one of the `*allocx` functions
+   * into the size that snmalloc should allocate.  snmalloc allocations are
+   * naturally aligned, so alignment is provided by rounding up the size.
+   *
+   * Returns 0 if the request cannot be satisfied.
+   */
+  SNMALLOC_FAST_PATH size_t allocx_size(size_t size, int flags)
+  {
+    size_t align_bits = static_cast<size_t>(flags & MALLOCX_LG_ALIGN_MASK);
+
+    if (size == 0)
+      size = 1;
+
+    if (align_bits != 0)
+    {
+      if (align_bits >= bits::ADDRESS_BITS)
+        return 0;
+      size = aligned_size(bits::one_at_bit(align_bits), size);
+    }
+
+    // Also catches aligned_size wrapping to zero.
+    if ((size - 1) >= bits::one_at_bit(bits::ADDRESS_BITS - 1))
+      return 0;
+
+    return size;
+  }
+}
+
+namespace
+{
+  /**
+   * Start the statistics exporter, after the next allocation, if it is
+   * configured in the environment.
+   */
+  [[maybe_unused]] const bool stats_export_from_environment =
+    StatsExporter::defer_start_from_environment();
+
+#ifndef SNMALLOC_PASS_THROUGH
+  /**
+   * Start the heap profiler, after the next allocation, if it is configured
+   * in the environment.
+   */
+  [[maybe_unused]] const bool heap_profile_from_environment =
+    HeapProfiler::defer_start_from_environment();
+#endif
+
+  /**
+   * Start tracing, after the next allocation, if it is configured in the
+   * environment.
+   */
+  [[maybe_unused]] const bool trace_from_environment =
+    AllocTracer::defer_start_from_environment();
+}
+
 extern "C"
 {
   void SNMALLOC_NAME_MANGLE(check_start)(void* ptr)
@@ -43,12 +123,15 @@ extern "C"
 
   SNMALLOC_EXPORT void* SNMALLOC_NAME_MANGLE(malloc)(size_t size)
   {
-    return ThreadAlloc::get_noncachable()->alloc(size);
+    void* p = ThreadAlloc::get_noncachable()->alloc(size);
+    AllocTracer::record(TraceOp::Malloc, address_cast(p), size);
+    return p;
   }
 
   SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(free)(void* ptr)
   {
     SNMALLOC_NAME_MANGLE(check_start)(ptr);
+    AllocTracer::record(TraceOp::Free, address_cast(ptr));
     ThreadAlloc::get_noncachable()->dealloc(ptr);
   }
 
@@ -66,7 +149,9 @@ extern "C"
       errno = ENOMEM;
       return nullptr;
     }
-    return ThreadAlloc::get_noncachable()->alloc<ZeroMem::YesZero>(sz);
+    void* p = ThreadAlloc::get_noncachable()->alloc<ZeroMem::YesZero>(sz);
+    AllocTracer::record(TraceOp::Calloc, address_cast(p), sz);
+    return p;
   }
 
   SNMALLOC_EXPORT
@@ -103,18 +188,29 @@ extern "C"
       // snmallocs alignment guarantees can be broken by realloc in pass-through
       // this is not exercised, by existing clients, but is tested.
       if (pointer_align_up(ptr, natural_alignment(size)) == ptr)
+      {
+        AllocTracer::record(
+          TraceOp::Realloc, address_cast(ptr), size, address_cast(ptr));
         return ptr;
+      }
 #else
+      AllocTracer::record(
+        TraceOp::Realloc, address_cast(ptr), size, address_cast(ptr));
       return ptr;
 #endif
     }
-    void* p = SNMALLOC_NAME_MANGLE(malloc)(size);
+    // Allocate and free directly, so that tracing records a single call.
+    void* p = ThreadAlloc::get_noncachable()->alloc(size);
     if (p != nullptr)
     {
       SNMALLOC_NAME_MANGLE(check_start)(p);
       sz = bits::min(size, sz);
       memcpy(p, ptr, sz);
-      SNMALLOC_NAME_MANGLE(free)(ptr);
+      // Record before the free, so that no other thread can reuse and
+      // record the old address first.
+      AllocTracer::record(
+        TraceOp::Realloc, address_cast(p), size, address_cast(ptr));
+      ThreadAlloc::get_noncachable()->dealloc(ptr);
     }
     return p;
   }
@@ -149,8 +245,15 @@ extern "C"
       return nullptr;
     }
 
-    return SNMALLOC_NAME_MANGLE(malloc)(
+    void* p = ThreadAlloc::get_noncachable()->alloc(
       size ? aligned_size(alignment, size) : alignment);
+    AllocTracer::record(
+      TraceOp::AlignedAlloc,
+      address_cast(p),
+      size,
+      0,
+      bits::next_pow2_bits(alignment));
+    return p;
   }
 
   SNMALLOC_EXPORT void*
@@ -197,6 +300,112 @@ extern "C"
       OS_PAGE_SIZE, (size + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1));
   }
 
+  // jemalloc-compatible extended allocation API.
+
+  SNMALLOC_EXPORT void* SNMALLOC_NAME_MANGLE(mallocx)(size_t size, int flags)
+  {
+    size_t sz = allocx_size(size, flags);
+    if (sz == 0)
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+
+    if ((flags & MALLOCX_ZERO) != 0)
+    {
+      void* p = ThreadAlloc::get_noncachable()->alloc<ZeroMem::YesZero>(sz);
+      AllocTracer::record(TraceOp::Calloc, address_cast(p), sz);
+      return p;
+    }
+
+    void* p = ThreadAlloc::get_noncachable()->alloc(sz);
+    AllocTracer::record(TraceOp::Malloc, address_cast(p), sz);
+    return p;
+  }
+
+  SNMALLOC_EXPORT void*
+    SNMALLOC_NAME_MANGLE(rallocx)(void* ptr, size_t size, int flags)
+  {
+    size_t new_sz = allocx_size(size, flags);
+    if (new_sz == 0)
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+
+    SNMALLOC_NAME_MANGLE(check_start)(ptr);
+
+    size_t sz = ThreadAlloc::get_noncachable()->alloc_size(ptr);
+    // Keep the current allocation if the new size is in the same sizeclass.
+    // Any zeroing requested by the flags applies only to the bytes past the
+    // old usable size, so there is nothing further to do.
+    if (sz == round_size(new_sz))
+    {
+#ifdef SNMALLOC_PASS_THROUGH
+      if (pointer_align_up(ptr, natural_alignment(new_sz)) == ptr)
+      {
+        AllocTracer::record(
+          TraceOp::Realloc, address_cast(ptr), size, address_cast(ptr));
+        return ptr;
+      }
+#else
+      AllocTracer::record(
+        TraceOp::Realloc, address_cast(ptr), size, address_cast(ptr));
+      return ptr;
+#endif
+    }
+
+    void* p = SNMALLOC_NAME_MANGLE(mallocx)(size, flags);
+    if (p != nullptr)
+    {
+      memcpy(p, ptr, bits::min(size, sz));
+      SNMALLOC_NAME_MANGLE(free)(ptr);
+    }
+    return p;
+  }
+
+  SNMALLOC_EXPORT size_t SNMALLOC_NAME_MANGLE(xallocx)(
+    void* ptr, size_t size, size_t extra, int flags)
+  {
+    // snmalloc cannot move an allocation between sizeclasses in place, so
+    // the best that can be done is to report the current usable size.  Any
+    // request that fits in it has succeeded.
+    UNUSED(size);
+    UNUSED(extra);
+    UNUSED(flags);
+    return ThreadAlloc::get_noncachable()->alloc_size(ptr);
+  }
+
+  SNMALLOC_EXPORT size_t
+    SNMALLOC_NAME_MANGLE(sallocx)(const void* ptr, int flags)
+  {
+    UNUSED(flags);
+    return ThreadAlloc::get_noncachable()->alloc_size(ptr);
+  }
+
+  SNMALLOC_EXPORT void
+    SNMALLOC_NAME_MANGLE(dallocx)(void* ptr, int flags)
+  {
+    UNUSED(flags);
+    SNMALLOC_NAME_MANGLE(free)(ptr);
+  }
+
+  SNMALLOC_EXPORT void
+    SNMALLOC_NAME_MANGLE(sdallocx)(void* ptr, size_t size, int flags)
+  {
+    SNMALLOC_NAME_MANGLE(check_start)(ptr);
+    AllocTracer::record(TraceOp::Free, address_cast(ptr));
+    ThreadAlloc::get_noncachable()->dealloc(ptr, allocx_size(size, flags));
+  }
+
+  SNMALLOC_EXPORT size_t SNMALLOC_NAME_MANGLE(nallocx)(size_t size, int flags)
+  {
+    size_t sz = allocx_size(size, flags);
+    if (sz == 0)
+      return 0;
+    return round_size(sz);
+  }
+
   // Stub implementations for jemalloc compatibility.
   // These are called by FreeBSD's libthr (pthreads) to notify malloc of
   // various events.  They are currently unused, though we may wish to reset
@@ -206,10 +415,142 @@ extern "C"
   SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(_malloc_postfork)(void) {}
   SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(_malloc_first_thread)(void) {}
 
+  /**
+   * Allocate `size` bytes attributed to allocation tag `tag`, which must be
+   * less than `arenas.ntags`.  The result is freed with `free`.
+   */
+  SNMALLOC_EXPORT void*
+    SNMALLOC_NAME_MANGLE(snmalloc_tagged_malloc)(size_t size, unsigned tag)
+  {
+    if (tag >= NUM_ALLOC_TAGS)
+    {
+      errno = EINVAL;
+      return nullptr;
+    }
+    return TaggedThreadAlloc::get(static_cast<alloc_tag_t>(tag))->alloc(size);
+  }
+
+  SNMALLOC_EXPORT void* SNMALLOC_NAME_MANGLE(snmalloc_tagged_calloc)(
+    size_t nmemb, size_t size, unsigned tag)
+  {
+    if (tag >= NUM_ALLOC_TAGS)
+    {
+      errno = EINVAL;
+      return nullptr;
+    }
+    bool overflow = false;
+    size_t sz = bits::umul(size, nmemb, overflow);
+    if (overflow)
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    return TaggedThreadAlloc::get(static_cast<alloc_tag_t>(tag))
+      ->alloc<ZeroMem::YesZero>(sz);
+  }
+
+  /**
+   * Bytes in live allocations with allocation tag `tag`, or 0 if `tag` is
+   * out of range.  This is also available as `stats.tags.<tag>.live`.
+   */
+  SNMALLOC_EXPORT size_t
+    SNMALLOC_NAME_MANGLE(snmalloc_tag_live_bytes)(unsigned tag)
+  {
+    if (tag >= NUM_ALLOC_TAGS)
+      return 0;
+    return mallctl::tag_live_bytes(tag);
+  }
+
+  /**
+   * Start writing a trace of calls to the allocator to the file at `path`.
+   * Returns 0 or an errno value.  See `trace.h` for the format.
+   */
   SNMALLOC_EXPORT int
-    SNMALLOC_NAME_MANGLE(mallctl)(const char*, void*, size_t*, void*, size_t)
+    SNMALLOC_NAME_MANGLE(snmalloc_trace_start)(const char* path)
+  {
+    return AllocTracer::start(path);
+  }
+
+  /**
+   * Stop tracing, and write out the trace.
+   */
+  SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(snmalloc_trace_stop)(void)
+  {
+    AllocTracer::stop();
+  }
+
+  /**
+   * Return as much unused memory as possible to the OS, as
+   * `AllocPool::trim` does, and return the number of bytes released.
+   */
+  SNMALLOC_EXPORT size_t SNMALLOC_NAME_MANGLE(snmalloc_trim)(void)
+  {
+    return current_alloc_pool()->trim(ThreadAlloc::get_noncachable());
+  }
+
+  /**
+   * glibc-compatible `malloc_trim`.  snmalloc keeps no padding at the top
+   * of a heap, so `pad` is ignored.  Returns 1 if any memory was released,
+   * and 0 otherwise; `snmalloc_trim` returns the number of bytes.
+   */
+  SNMALLOC_EXPORT int SNMALLOC_NAME_MANGLE(malloc_trim)(size_t pad)
+  {
+    UNUSED(pad);
+    return (SNMALLOC_NAME_MANGLE(snmalloc_trim)() != 0) ? 1 : 0;
+  }
+
+  /**
+   * Process the deallocations other threads have sent to this thread's
+   * allocators, and send those cached for other threads to their owners, as
+   * `thread.tcache.flush` does.  This is for threads that are about to go
+   * idle, which would otherwise hold that memory until they next allocate
+   * or free.
+   */
+  SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(snmalloc_thread_flush)(void)
+  {
+    ThreadAlloc::get_noncachable()->flush();
+    TaggedThreadAlloc::flush();
+  }
+
+  /**
+   * Returns 1 if moving the object at `ptr` would help to empty a sparsely
+   * used slab, and 0 otherwise.  An object is moved by allocating a copy
+   * straight away, from the same thread, and freeing the original; see
+   * `Allocator::defrag_hint`.
+   */
+  SNMALLOC_EXPORT int SNMALLOC_NAME_MANGLE(snmalloc_defrag_hint)(void* ptr)
+  {
+    if (ptr == nullptr)
+      return 0;
+    return ThreadAlloc::get_noncachable()->defrag_hint(ptr) ? 1 : 0;
+  }
+
+  SNMALLOC_EXPORT int SNMALLOC_NAME_MANGLE(mallctl)(
+    const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+  {
+    return mallctl::ctl(name, oldp, oldlenp, newp, newlen);
+  }
+
+  /**
+   * Start exporting statistics to `fd` every `interval_ms` milliseconds, as
+   * JSON lines or, if `csv` is non-zero, as CSV.  Returns 0 or an errno
+   * value.  See `statsexport.h` for the format.
+   */
+  SNMALLOC_EXPORT int SNMALLOC_NAME_MANGLE(snmalloc_stats_export_start)(
+    int fd, uint64_t interval_ms, int csv)
+  {
+    return StatsExporter::start(
+      fd,
+      interval_ms,
+      (csv != 0) ? StatsExportFormat::CSV : StatsExportFormat::JsonLines);
+  }
+
+  /**
+   * Stop exporting statistics, after writing a final snapshot.
+   */
+  SNMALLOC_EXPORT void SNMALLOC_NAME_MANGLE(snmalloc_stats_export_stop)(void)
   {
-    return ENOENT;
+    StatsExporter::stop();
   }
 
 #ifdef SNMALLOC_EXPOSE_PAGEMAP
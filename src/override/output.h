@@ -0,0 +1,100 @@
+#pragma once
+
+#include "../ds/address.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  define SNMALLOC_FD_OUTPUT
+#  include <unistd.h>
+#endif
+
+namespace snmalloc
+{
+  /**
+   * Fixed-size output buffer that is written to a file descriptor whenever
+   * it fills up, and when it is destroyed.  This never allocates, so it can
+   * be used to report on the allocator from inside it.
+   */
+  class FdOutput
+  {
+    int fd;
+    size_t used = 0;
+    char buffer[4096];
+
+  public:
+    FdOutput(int fd) : fd(fd) {}
+
+    ~FdOutput()
+    {
+      flush();
+    }
+
+    void flush()
+    {
+#ifdef SNMALLOC_FD_OUTPUT
+      const char* p = buffer;
+      while (used > 0)
+      {
+        ssize_t written = ::write(fd, p, used);
+        if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+        p += written;
+        used -= static_cast<size_t>(written);
+      }
+#endif
+      used = 0;
+    }
+
+    FdOutput& operator<<(char c)
+    {
+      if (used == sizeof(buffer))
+        flush();
+      buffer[used++] = c;
+      return *this;
+    }
+
+    FdOutput& operator<<(const char* str)
+    {
+      while (*str != '\0')
+        *this << *str++;
+      return *this;
+    }
+
+    FdOutput& operator<<(size_t value)
+    {
+      char digits[24];
+      size_t n = sizeof(digits);
+      digits[--n] = '\0';
+      do
+      {
+        digits[--n] = static_cast<char>('0' + (value % 10));
+        value /= 10;
+      } while (value != 0);
+      return *this << &digits[n];
+    }
+
+    /**
+     * Write an address in hexadecimal, with a `0x` prefix.
+     */
+    FdOutput& operator<<(const void* p)
+    {
+      address_t value = address_cast(p);
+      char digits[2 * sizeof(address_t) + 1];
+      size_t n = sizeof(digits);
+      digits[--n] = '\0';
+      do
+      {
+        digits[--n] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+      } while (value != 0);
+      return *this << "0x" << &digits[n];
+    }
+  };
+} // namespace snmalloc
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "mallctl.h"
+#include "output.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  define SNMALLOC_STATS_EXPORT
+#  include <fcntl.h>
+#  include <pthread.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+/**
+ * Periodic export of aggregated allocator statistics.
+ *
+ * A background thread writes a snapshot every interval to a file descriptor,
+ * either as JSON lines or as CSV records in the style of `AllocStats::print`.
+ * Counters are reported as the change since the previous snapshot, and
+ * gauges (bytes resident, active, and so on) as their current value.  Each
+ * snapshot is formatted into a buffer on the stack and written with
+ * `write`, so exporting never allocates.  In CSV, each call to `start` writes
+ * a header record before its first snapshot, so a file that several runs
+ * append to has a header before the records of each run.
+ *
+ * The exporter can be started with `StatsExporter::start` or, through the
+ * malloc shim, from the environment.  The shim reads the environment from a
+ * static initialiser, but creating the exporter thread may allocate, so it
+ * defers starting the thread until after the next allocation (see
+ * `DeferredWork`).  The variables are:
+ *
+ *  - `SNMALLOC_STATS_EXPORT`: a path to append to, or `fd:<n>` to use an
+ *    already open file descriptor.
+ *  - `SNMALLOC_STATS_EXPORT_INTERVAL_MS`: the period, 1000 by default.
+ *  - `SNMALLOC_STATS_EXPORT_FORMAT`: `json` (the default) or `csv`.
+ *  - `SNMALLOC_LATENCY_HISTOGRAMS`: if set to 1, record slow path latencies
+ *    (see `LatencyTimer`).  The JSON snapshots then include, for each slow
+ *    path, the calls in each log2 tick bucket since the previous snapshot.
+ *
+ * This is only available on POSIX platforms.
+ */
+namespace snmalloc
+{
+  enum class StatsExportFormat
+  {
+    JsonLines,
+    CSV
+  };
+
+  class StatsExporter
+  {
+    /**
+     * Exporter state.  This is in static storage so that exporting never
+     * needs to allocate.
+     */
+    struct State
+    {
+      std::atomic<bool> running{false};
+      std::atomic<bool> stopping{false};
+      int fd = -1;
+      bool owns_fd = false;
+      uint64_t interval_ms = 1000;
+      StatsExportFormat format = StatsExportFormat::JsonLines;
+      bool header = false;
+      uint64_t sequence = 0;
+      uint64_t last_ms = 0;
+      AllocCounterTotals last;
+#ifdef SNMALLOC_STATS_EXPORT
+      pthread_t thread;
+#endif
+    };
+
+    static State& state()
+    {
+      static State s;
+      return s;
+    }
+
+    static uint64_t now_ms(bool monotonic)
+    {
+#ifdef SNMALLOC_STATS_EXPORT
+      struct timespec ts;
+      clock_gettime(monotonic ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ts);
+      return (static_cast<uint64_t>(ts.tv_sec) * 1000) +
+        (static_cast<uint64_t>(ts.tv_nsec) / 1000000);
+#else
+      UNUSED(monotonic);
+      return 0;
+#endif
+    }
+
+    /**
+     * Write one snapshot.  Only called by the exporter thread, or after it
+     * has stopped.
+     */
+    static void write_snapshot()
+    {
+      auto& s = state();
+      auto counters = mallctl::aggregate_counters();
+      auto usage = default_memory_provider().memory_usage();
+      uint64_t mono = now_ms(true);
+      size_t interval = (s.sequence == 0) ? 0 : mono - s.last_ms;
+
+      size_t small_slabs = 0;
+      size_t refilled = 0;
+      size_t medium_allocs = 0;
+      size_t medium_deallocs = 0;
+      size_t large_allocs = 0;
+      size_t large_deallocs = 0;
+      for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
+      {
+        small_slabs +=
+          counters.small_slabs_allocated[i] - counters.small_slabs_deallocated[i];
+        refilled += counters.small_refilled[i] - s.last.small_refilled[i];
+      }
+      for (size_t i = 0; i < NUM_MEDIUM_CLASSES; i++)
+      {
+        medium_allocs +=
+          counters.medium_allocated[i] - s.last.medium_allocated[i];
+        medium_deallocs +=
+          counters.medium_deallocated[i] - s.last.medium_deallocated[i];
+      }
+      for (size_t i = 0; i < NUM_LARGE_CLASSES; i++)
+      {
+        large_allocs += counters.large_allocated[i] - s.last.large_allocated[i];
+        large_deallocs +=
+          counters.large_deallocated[i] - s.last.large_deallocated[i];
+      }
+
+      struct Field
+      {
+        const char* name;
+        size_t value;
+      };
+
+      Field fields[] = {
+        {"seq", static_cast<size_t>(s.sequence)},
+        {"time_ms", static_cast<size_t>(now_ms(false))},
+        {"interval_ms", interval},
+        {"mapped", usage.second},
+        {"resident", usage.first},
+        {"active", counters.active_bytes()},
+        {"allocated", mallctl::allocated_bytes()},
+        {"small_slabs", small_slabs},
+        {"small_refilled", refilled},
+        {"medium_allocs", medium_allocs},
+        {"medium_deallocs", medium_deallocs},
+        {"large_allocs", large_allocs},
+        {"large_deallocs", large_deallocs},
+        {"remote_posts", counters.remote_posts - s.last.remote_posts},
+        {"remote_received", counters.remote_received - s.last.remote_received},
+        {"remote_forwarded",
+         counters.remote_forwarded - s.last.remote_forwarded},
+      };
+
+      FdOutput out(s.fd);
+
+      if (s.format == StatsExportFormat::CSV)
+      {
+        // Keep the style of AllocStats::print: a header record, and then
+        // one record per dump.
+        if (s.header)
+        {
+          out << "SnapshotStats";
+          for (auto& f : fields)
+            out << ", " << f.name;
+          out << "\n";
+          s.header = false;
+        }
+        out << "SnapshotStats";
+        for (auto& f : fields)
+          out << ", " << f.value;
+        out << "\n";
+      }
+      else
+      {
+        const char* sep = "{";
+        for (auto& f : fields)
+        {
+          out << sep << "\"" << f.name << "\":" << f.value;
+          sep = ",";
+        }
+
+        // Per-sizeclass detail for the small classes, to chart
+        // fragmentation by sizeclass.
+        out << ",\"small_slabs_by_class\":[";
+        for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
+        {
+          out << ((i == 0) ? "" : ",")
+              << (counters.small_slabs_allocated[i] -
+                  counters.small_slabs_deallocated[i]);
+        }
+        out << "],\"small_refilled_by_class\":[";
+        for (size_t i = 0; i < NUM_SMALL_CLASSES; i++)
+        {
+          out << ((i == 0) ? "" : ",")
+              << (counters.small_refilled[i] - s.last.small_refilled[i]);
+        }
+
+        // Remote frees by the slot of their owner, and remote cache posts by
+        // the number of rounds they took; see `stats.remote` in mallctl.h.
+        out << "],\"remote_sent_by_slot\":[";
+        for (size_t i = 0; i < REMOTE_SLOTS; i++)
+        {
+          out << ((i == 0) ? "" : ",")
+              << (counters.remote_sent[i] - s.last.remote_sent[i]);
+        }
+        out << "],\"remote_post_rounds\":[";
+        for (size_t i = 0; i < NUM_POST_ROUND_BUCKETS; i++)
+        {
+          out << ((i == 0) ? "" : ",")
+              << (counters.remote_post_rounds[i] -
+                  s.last.remote_post_rounds[i]);
+        }
+        out << "]";
+
+        if (LatencyTimer::is_enabled())
+        {
+          out << ",\"latency\":{";
+          for (size_t i = 0; i < NUM_SLOW_PATHS; i++)
+          {
+            out << ((i == 0) ? "\"" : ",\"") << slow_path_name(i) << "\":[";
+            for (size_t b = 0; b < NUM_LATENCY_BUCKETS; b++)
+            {
+              out << ((b == 0) ? "" : ",")
+                  << (counters.latency[i][b] - s.last.latency[i][b]);
+            }
+            out << "]";
+          }
+          out << "}";
+        }
+        out << "}\n";
+      }
+
+      s.last = counters;
+      s.last_ms = mono;
+      s.sequence++;
+    }
+
+    static void enable_latency_from_environment()
+    {
+      const char* latency = getenv("SNMALLOC_LATENCY_HISTOGRAMS");
+      if ((latency != nullptr) && (strcmp(latency, "1") == 0))
+        LatencyTimer::enable(true);
+    }
+
+#ifdef SNMALLOC_STATS_EXPORT
+    static void* run(void*)
+    {
+      auto& s = state();
+      while (true)
+      {
+        // Sleep in short steps, so that `stop` does not wait for a whole
+        // interval.
+        uint64_t remaining = s.interval_ms;
+        while (remaining > 0)
+        {
+          if (s.stopping.load(std::memory_order_acquire))
+            return nullptr;
+
+          uint64_t step = bits::min<uint64_t>(remaining, 50);
+          struct timespec ts = {static_cast<time_t>(step / 1000),
+                                static_cast<long>((step % 1000) * 1000000)};
+          nanosleep(&ts, nullptr);
+          remaining -= step;
+        }
+
+        write_snapshot();
+      }
+    }
+#endif
+
+  public:
+    /**
+     * Start exporting to `fd` every `interval_ms` milliseconds.  If
+     * `owns_fd` is set, the file descriptor is closed by `stop`.  Returns 0,
+     * or an errno value if the exporter is already running or cannot be
+     * started.
+     */
+    static int start(
+      int fd,
+      uint64_t interval_ms,
+      StatsExportFormat format = StatsExportFormat::JsonLines,
+      bool owns_fd = false)
+    {
+#ifdef SNMALLOC_STATS_EXPORT
+      auto& s = state();
+      if ((fd < 0) || (interval_ms == 0))
+        return EINVAL;
+
+      if (s.running.exchange(true))
+        return EBUSY;
+
+      s.fd = fd;
+      s.owns_fd = owns_fd;
+      s.interval_ms = interval_ms;
+      s.format = format;
+      s.header = (format == StatsExportFormat::CSV);
+      s.sequence = 0;
+      s.last = AllocCounterTotals();
+      s.stopping.store(false, std::memory_order_release);
+
+      // The first snapshot is the baseline for the deltas that follow.
+      write_snapshot();
+
+      int err = pthread_create(&s.thread, nullptr, &run, nullptr);
+      if (err != 0)
+        s.running = false;
+      return err;
+#else
+      UNUSED(fd);
+      UNUSED(interval_ms);
+      UNUSED(format);
+      UNUSED(owns_fd);
+      return ENOSYS;
+#endif
+    }
+
+    /**
+     * Start exporting to the file at `path`, which is created if necessary
+     * and appended to.
+     */
+    static int start(
+      const char* path,
+      uint64_t interval_ms,
+      StatsExportFormat format = StatsExportFormat::JsonLines)
+    {
+#ifdef SNMALLOC_STATS_EXPORT
+      int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (fd < 0)
+        return errno;
+
+      int err = start(fd, interval_ms, format, true);
+      if (err != 0)
+        ::close(fd);
+      return err;
+#else
+      UNUSED(path);
+      UNUSED(interval_ms);
+      UNUSED(format);
+      return ENOSYS;
+#endif
+    }
+
+    /**
+     * Stop the exporter, after writing a final snapshot.
+     */
+    static void stop()
+    {
+#ifdef SNMALLOC_STATS_EXPORT
+      auto& s = state();
+      if (!s.running.load())
+        return;
+
+      s.stopping.store(true, std::memory_order_release);
+      pthread_join(s.thread, nullptr);
+      write_snapshot();
+
+      if (s.owns_fd)
+        ::close(s.fd);
+      s.fd = -1;
+      s.running = false;
+#endif
+    }
+
+    /**
+     * Start the exporter if it is configured in the environment.  Returns
+     * true if it was started.  This creates a thread, so the malloc shim
+     * calls it through `defer_start_from_environment`.
+     */
+    static bool start_from_environment()
+    {
+      enable_latency_from_environment();
+
+      const char* target = getenv("SNMALLOC_STATS_EXPORT");
+      if ((target == nullptr) || (*target == '\0'))
+        return false;
+
+      uint64_t interval_ms = 1000;
+      const char* interval = getenv("SNMALLOC_STATS_EXPORT_INTERVAL_MS");
+      if (interval != nullptr)
+      {
+        interval_ms = strtoull(interval, nullptr, 10);
+        if (interval_ms == 0)
+          interval_ms = 1000;
+      }
+
+      auto format = StatsExportFormat::JsonLines;
+      const char* f = getenv("SNMALLOC_STATS_EXPORT_FORMAT");
+      if ((f != nullptr) && (strcmp(f, "csv") == 0))
+        format = StatsExportFormat::CSV;
+
+      int err = (strncmp(target, "fd:", 3) == 0) ?
+        start(atoi(target + 3), interval_ms, format) :
+        start(target, interval_ms, format);
+      if (err != 0)
+        return false;
+
+      // Write a final snapshot when the process exits.
+      atexit(&stop);
+      return true;
+    }
+
+    /**
+     * Arrange for `start_from_environment` to run after the next allocation,
+     * if the exporter is configured in the environment.  This is safe to
+     * call from a static initialiser.  Returns true if the exporter is
+     * configured.
+     */
+    static bool defer_start_from_environment()
+    {
+      enable_latency_from_environment();
+
+      const char* target = getenv("SNMALLOC_STATS_EXPORT");
+      if ((target == nullptr) || (*target == '\0'))
+        return false;
+
+#ifdef SNMALLOC_PASS_THROUGH
+      // Allocations go to the system allocator and never reach the slow path
+      // that runs deferred work, so the exporter must be started with
+      // `start`.
+      return false;
+#else
+      current_alloc_pool()->defer([]() { start_from_environment(); });
+      return true;
+#endif
+    }
+  };
+} // namespace snmalloc
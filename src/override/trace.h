@@ -0,0 +1,364 @@
+#pragma once
+
+#include "../snmalloc.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#  define SNMALLOC_TRACE
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+/**
+ * Recorder for traces of the calls made to the malloc shim, which can be
+ * re-executed by `src/test/perf/replay` to measure the allocator against
+ * real allocation patterns.
+ *
+ * A trace file is a `TraceHeader` followed by `TraceRecord`s.  Each thread
+ * appends records to a buffer of its own, which is written to the file when
+ * it fills, when the thread exits, and when tracing stops, so records from
+ * different threads are interleaved in blocks.  Records carry a timestamp
+ * from `Aal::tick`, by which the replay restores the global order.
+ *
+ * Calls are recorded where the shim calls into the allocator, so the
+ * `*allocx` functions are recorded as the equivalent standard calls, and
+ * allocations made with allocation tags or through the C++ operators are
+ * not recorded.  Objects are identified by their address.  The replay renames them to
+ * unique identifiers, so that an address that is freed and then reused is
+ * two different objects.
+ *
+ * Tracing can be started with `AllocTracer::start` or, through the malloc
+ * shim, from the environment: `SNMALLOC_TRACE` is a path to write the trace
+ * to, which starts after the first allocation and stops when the process
+ * exits.  Objects allocated before it starts are not in the trace, and the
+ * replay skips their frees.  Tracing should be stopped while
+ * no other thread is allocating; records that race with stopping may be
+ * lost.
+ *
+ * This is only available on POSIX platforms.
+ */
+namespace snmalloc
+{
+  enum class TraceOp : uint8_t
+  {
+    Malloc = 1,
+    Calloc,
+    Realloc,
+    AlignedAlloc,
+    Free
+  };
+
+  struct TraceHeader
+  {
+    static constexpr char MAGIC[8] = {'S', 'N', 'M', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+  };
+
+  struct TraceRecord
+  {
+    /**
+     * Time of the call.  Allocations are stamped after they return, and
+     * frees before they start, so an address is always freed before it is
+     * reused.
+     */
+    uint64_t tick;
+
+    /**
+     * The object allocated or freed.  For `Realloc`, the new object.
+     */
+    uint64_t address;
+
+    /**
+     * For `Realloc`, the object passed in.  This is the same as `address` if
+     * the object was resized in place.
+     */
+    uint64_t old_address;
+
+    /**
+     * Requested size, or 0 for `Free`.
+     */
+    uint64_t size;
+
+    /**
+     * Index of the thread, in the order that threads first made a traced
+     * call, or `UINT32_MAX` for calls made by a thread while it exits.
+     */
+    uint32_t thread;
+
+    TraceOp op;
+
+    /**
+     * Log2 of the requested alignment for `AlignedAlloc`, and 0 otherwise.
+     */
+    uint8_t lg_align;
+
+    uint16_t reserved;
+  };
+
+  static_assert(sizeof(TraceRecord) == 40, "Trace records are a fixed size");
+
+  class TraceBuffer : public Pooled<TraceBuffer>
+  {
+  public:
+    static constexpr size_t CAPACITY = 4096;
+
+    uint32_t thread = 0;
+    size_t used = 0;
+    TraceRecord records[CAPACITY];
+  };
+
+  class AllocTracer
+  {
+    inline static std::atomic<bool> enabled{false};
+
+    /**
+     * Protects `fd` and writes to it.
+     */
+    inline static std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    inline static int fd = -1;
+
+    inline static std::atomic<uint32_t> next_thread{0};
+
+    static Pool<TraceBuffer>* buffers()
+    {
+      static Pool<TraceBuffer>* pool = Pool<TraceBuffer>::make();
+      return pool;
+    }
+
+    static TraceBuffer*& local()
+    {
+      static thread_local TraceBuffer* buffer = nullptr;
+      return buffer;
+    }
+
+    static void write_all(const void* data, size_t len)
+    {
+#ifdef SNMALLOC_TRACE
+      auto* p = static_cast<const char*>(data);
+      while (len > 0)
+      {
+        ssize_t written = ::write(fd, p, len);
+        if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+        p += written;
+        len -= static_cast<size_t>(written);
+      }
+#else
+      UNUSED(data);
+      UNUSED(len);
+#endif
+    }
+
+    static void flush(TraceBuffer* b)
+    {
+      {
+        FlagLock f(lock);
+        if (fd >= 0)
+          write_all(b->records, b->used * sizeof(TraceRecord));
+      }
+      b->used = 0;
+    }
+
+    /**
+     * Set once this thread's buffer has been released.  Any later calls made
+     * by the thread, from other thread-local destructors, are written
+     * unbuffered.
+     */
+    inline static thread_local bool destructor_has_run = false;
+
+    static void release_local()
+    {
+      auto*& b = local();
+      flush(b);
+      buffers()->release(b);
+      b = nullptr;
+      destructor_has_run = true;
+    }
+
+    static SNMALLOC_SLOW_PATH TraceBuffer* acquire_local()
+    {
+      auto*& b = local();
+      b = buffers()->acquire();
+      b->thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+      b->used = 0;
+
+      // Registering the destructor may allocate, which records into the
+      // buffer that has just been installed.
+      static thread_local OnDestruct<release_local> tidier;
+      UNUSED(tidier);
+      return b;
+    }
+
+    static SNMALLOC_SLOW_PATH void record_slow(
+      TraceOp op,
+      address_t address,
+      address_t old_address,
+      size_t size,
+      size_t lg_align)
+    {
+      // Failed allocations and frees of null change nothing.
+      if (address == 0)
+        return;
+
+      TraceRecord r;
+      r.tick = Aal::tick();
+      r.address = address;
+      r.old_address = old_address;
+      r.size = size;
+      r.op = op;
+      r.lg_align = static_cast<uint8_t>(lg_align);
+      r.reserved = 0;
+
+      if (unlikely(destructor_has_run))
+      {
+        r.thread = UINT32_MAX;
+        FlagLock f(lock);
+        if (fd >= 0)
+          write_all(&r, sizeof(r));
+        return;
+      }
+
+      auto* b = local();
+      if (b == nullptr)
+        b = acquire_local();
+
+      r.thread = b->thread;
+      b->records[b->used] = r;
+      if (++b->used == TraceBuffer::CAPACITY)
+        flush(b);
+    }
+
+    static void stop_at_exit()
+    {
+      stop();
+    }
+
+  public:
+    static SNMALLOC_FAST_PATH bool is_enabled()
+    {
+      return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Record a call to the shim, if tracing is enabled.  This takes
+     * addresses rather than pointers, so that it can record an object that
+     * has already been freed.
+     */
+    static SNMALLOC_FAST_PATH void record(
+      TraceOp op,
+      address_t address,
+      size_t size = 0,
+      address_t old_address = 0,
+      size_t lg_align = 0)
+    {
+      if (unlikely(is_enabled()))
+        record_slow(op, address, old_address, size, lg_align);
+    }
+
+    /**
+     * Start writing a trace to the file at `path`, replacing it if it
+     * exists.  Returns 0 or an errno value.
+     */
+    static int start(const char* path)
+    {
+#ifdef SNMALLOC_TRACE
+      if (path == nullptr)
+        return EINVAL;
+
+      FlagLock f(lock);
+      if (fd >= 0)
+        return EBUSY;
+
+      fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0)
+        return errno;
+
+      TraceHeader header;
+      memcpy(header.magic, TraceHeader::MAGIC, sizeof(header.magic));
+      header.version = TraceHeader::VERSION;
+      header.record_size = sizeof(TraceRecord);
+      write_all(&header, sizeof(header));
+
+      enabled.store(true, std::memory_order_relaxed);
+      return 0;
+#else
+      UNUSED(path);
+      return ENOSYS;
+#endif
+    }
+
+    /**
+     * Stop tracing, and write out and close the trace.
+     */
+    static void stop()
+    {
+      if (!is_enabled())
+        return;
+
+      enabled.store(false, std::memory_order_relaxed);
+
+      auto* pool = buffers();
+      for (auto* b = pool->iterate(); b != nullptr; b = pool->iterate(b))
+      {
+        if (b->used != 0)
+          flush(b);
+      }
+
+#ifdef SNMALLOC_TRACE
+      FlagLock f(lock);
+      ::close(fd);
+      fd = -1;
+#endif
+    }
+
+    /**
+     * Start tracing if it is configured in the environment.  Returns true if
+     * it was started.  This registers an `atexit` handler, so the malloc shim
+     * calls it through `defer_start_from_environment`.
+     */
+    static bool start_from_environment()
+    {
+      const char* path = getenv("SNMALLOC_TRACE");
+      if ((path == nullptr) || (*path == '\0'))
+        return false;
+
+      if (start(path) != 0)
+        return false;
+
+      atexit(&stop_at_exit);
+      return true;
+    }
+
+    /**
+     * Arrange for `start_from_environment` to run after the next allocation,
+     * if tracing is configured in the environment.  This is safe to call
+     * from a static initialiser.  Returns true if tracing is configured.
+     */
+    static bool defer_start_from_environment()
+    {
+      const char* path = getenv("SNMALLOC_TRACE");
+      if ((path == nullptr) || (*path == '\0'))
+        return false;
+
+#ifdef SNMALLOC_PASS_THROUGH
+      // Allocations go to the system allocator and never reach the slow path
+      // that runs deferred work, so tracing must be started with `start`.
+      return false;
+#else
+      current_alloc_pool()->defer([]() { start_from_environment(); });
+      return true;
+#endif
+    }
+  };
+} // namespace snmalloc
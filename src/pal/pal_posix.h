@@ -141,6 +141,22 @@ namespace snmalloc
 #endif
     }
 
+    /**
+     * Capture up to `max` return addresses from the current stack into
+     * `frames`.  Returns the number captured, which is 0 if stack traces are
+     * not available.
+     */
+    static size_t capture_stack_trace(void** frames, size_t max)
+    {
+#ifdef BACKTRACE_HEADER
+      return static_cast<size_t>(backtrace(frames, static_cast<int>(max)));
+#else
+      UNUSED(frames);
+      UNUSED(max);
+      return 0;
+#endif
+    }
+
     /**
      * Report a fatal error an exit.
      */
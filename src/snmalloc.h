@@ -1,3 +1,4 @@
 #pragma once
 
+#include "mem/tagalloc.h"
 #include "mem/threadalloc.h"
@@ -0,0 +1,107 @@
+/**
+ * Tests for the adoption of a released allocator's partially used slabs by
+ * an allocator that needs a new superslab.
+ */
+
+#include <iostream>
+#include <snmalloc.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+#ifndef SNMALLOC_PASS_THROUGH
+void check(bool ok, const char* what)
+{
+  if (!ok)
+  {
+    std::cout << "Failed: " << what << std::endl;
+    abort();
+  }
+}
+
+/**
+ * Returns true if `a` owns the slab holding `p`.  The utilisation of a slab
+ * that another allocator owns is not filled in.
+ */
+bool owns(Alloc* a, void* p)
+{
+  SlabUtilization u;
+  bool next;
+  a->slab_utilization(p, u, next);
+  return u.nregs > 1;
+}
+
+void test_adopt()
+{
+  const size_t size = 48;
+  const size_t count = 4000;
+  auto* a = ThreadAlloc::get();
+  a->dealloc(a->alloc(16));
+
+  // A thread frees half of its objects and exits, so that its allocator is
+  // released with partially used slabs.
+  std::vector<void*> kept;
+  std::thread t([&kept]() {
+    auto* b = ThreadAlloc::get();
+    std::vector<void*> objects;
+    for (size_t i = 0; i < count; i++)
+      objects.push_back(b->alloc(size));
+    for (size_t i = 0; i < count; i++)
+    {
+      if ((i % 2) == 0)
+        b->dealloc(objects[i], size);
+      else
+        kept.push_back(objects[i]);
+    }
+  });
+  t.join();
+  check(!owns(a, kept[0]), "slabs start with their allocator");
+
+  // Fill this allocator's superslab, so that it needs another.
+  const size_t filler = 1024;
+  std::vector<void*> fillers;
+  while (!owns(a, kept[0]))
+  {
+    check(
+      fillers.size() < (2 * SUPERSLAB_SIZE) / filler,
+      "released slabs are adopted");
+    fillers.push_back(a->alloc(filler));
+  }
+
+  // The adopted slabs' free objects are allocated again.
+  std::vector<void*> reused;
+  for (size_t i = 0; i < count / 2; i++)
+    reused.push_back(a->alloc(size));
+  for (auto p : reused)
+    a->dealloc(p, size);
+
+  // The kept objects are freed here and by a thread that reuses the released
+  // allocator, which must send them to their new owner.
+  std::thread u([&kept]() {
+    auto* b = ThreadAlloc::get();
+    for (size_t i = 0; i < kept.size(); i += 2)
+      b->dealloc(kept[i], size);
+    b->flush();
+  });
+  u.join();
+  for (size_t i = 1; i < kept.size(); i += 2)
+    a->dealloc(kept[i], size);
+  for (auto p : fillers)
+    a->dealloc(p, filler);
+
+  current_alloc_pool()->debug_check_empty();
+}
+#endif
+
+int main()
+{
+  setup();
+
+#ifndef SNMALLOC_PASS_THROUGH
+  test_adopt();
+#endif
+
+  return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * Tests for the sampling heap profiler.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <test/setup.h>
+#include <vector>
+
+#define SNMALLOC_NAME_MANGLE(a) our_##a
+#include "../../../override/malloc.cc"
+
+using namespace snmalloc;
+
+#if defined(SNMALLOC_HEAP_PROFILE_DUMP) && !defined(SNMALLOC_PASS_THROUGH)
+#  include <stdlib.h>
+#  include <unistd.h>
+
+struct Profile
+{
+  size_t live_objects = 0;
+  size_t live_bytes = 0;
+  size_t objects = 0;
+  size_t bytes = 0;
+  size_t interval = 0;
+  size_t stacks = 0;
+  bool has_mappings = false;
+};
+
+Profile dump(const char* path)
+{
+  if (our_mallctl("prof.dump", nullptr, nullptr, &path, sizeof(path)) != 0)
+  {
+    fprintf(stderr, "prof.dump failed\n");
+    abort();
+  }
+
+  FILE* f = fopen(path, "r");
+  if (f == nullptr)
+    abort();
+
+  Profile p;
+  if (
+    fscanf(
+      f,
+      "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+      &p.live_objects,
+      &p.live_bytes,
+      &p.objects,
+      &p.bytes,
+      &p.interval) != 5)
+  {
+    fprintf(stderr, "Malformed profile header\n");
+    abort();
+  }
+
+  char line[4096];
+  while (fgets(line, sizeof(line), f) != nullptr)
+  {
+    if (strcmp(line, "MAPPED_LIBRARIES:\n") == 0)
+      p.has_mappings = true;
+    else if (!p.has_mappings && (strstr(line, "] @ 0x") != nullptr))
+      p.stacks++;
+  }
+  fclose(f);
+
+  fprintf(
+    stderr,
+    "profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu, %zu stacks\n",
+    p.live_objects,
+    p.live_bytes,
+    p.objects,
+    p.bytes,
+    p.interval,
+    p.stacks);
+  return p;
+}
+
+void set_active(bool on)
+{
+  if (our_mallctl("prof.active", nullptr, nullptr, &on, sizeof(on)) != 0)
+    abort();
+}
+
+/**
+ * Allocations from a function of their own, so that they have a distinct
+ * stack.
+ */
+SNMALLOC_SLOW_PATH void allocate(std::vector<void*>& allocs, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    allocs.push_back(our_malloc(1024));
+}
+
+void test_profile()
+{
+  bool prof;
+  size_t len = sizeof(prof);
+  if ((our_mallctl("opt.prof", &prof, &len, nullptr, 0) != 0) || !prof)
+    abort();
+
+  // Sample every 4 KiB on average.
+  size_t lg_sample = 12;
+  if (our_mallctl("prof.reset", nullptr, nullptr, &lg_sample, sizeof(lg_sample)) != 0)
+    abort();
+  size_t read_lg_sample;
+  len = sizeof(read_lg_sample);
+  if (
+    (our_mallctl("prof.lg_sample", &read_lg_sample, &len, nullptr, 0) != 0) ||
+    (read_lg_sample != lg_sample))
+    abort();
+
+  char path[] = "/tmp/snmalloc_heap_profile_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    abort();
+  close(fd);
+
+  set_active(true);
+  bool active = false;
+  len = sizeof(active);
+  if ((our_mallctl("prof.active", &active, &len, nullptr, 0) != 0) || !active)
+    abort();
+
+  // 4 MiB of allocations, which should give about 1000 samples.
+  std::vector<void*> allocs;
+  allocs.reserve(4096);
+  allocate(allocs, 4096);
+
+  Profile live = dump(path);
+  if (live.interval != bits::one_at_bit(lg_sample))
+    abort();
+  if ((live.live_objects < 500) || (live.live_objects > 2000))
+    abort();
+  if (live.live_bytes != live.live_objects * 1024)
+    abort();
+  if ((live.objects != live.live_objects) || !live.has_mappings)
+    abort();
+  if (live.stacks == 0)
+    abort();
+
+  // Freed samples are removed from the live profile, but still count
+  // towards the cumulative one until it is reset.
+  for (auto p : allocs)
+    our_free(p);
+
+  Profile freed = dump(path);
+  if ((freed.live_objects != 0) || (freed.live_bytes != 0))
+    abort();
+  if (freed.objects != live.objects)
+    abort();
+
+  // Removing the samples leaves no tombstones, as nothing follows them.
+  if (HeapProfile::debug_tombstones() != 0)
+    abort();
+
+  if (our_mallctl("prof.reset", nullptr, nullptr, nullptr, 0) != 0)
+    abort();
+  Profile reset = dump(path);
+  if ((reset.objects != 0) || (reset.bytes != 0))
+    abort();
+
+  // Nothing is sampled once the profiler has been stopped.
+  set_active(false);
+  allocs.clear();
+  allocate(allocs, 4096);
+  Profile stopped = dump(path);
+  if (stopped.objects != 0)
+    abort();
+  for (auto p : allocs)
+    our_free(p);
+
+  unlink(path);
+}
+
+bool is_active()
+{
+  bool active = false;
+  size_t len = sizeof(active);
+  if (our_mallctl("prof.active", &active, &len, nullptr, 0) != 0)
+    abort();
+  return active;
+}
+
+void test_deferred_start()
+{
+  // The profile is written when the process exits.
+  setenv("SNMALLOC_HEAP_PROFILE", "/dev/null", 1);
+  if (!HeapProfiler::defer_start_from_environment())
+    abort();
+  if (is_active())
+    abort();
+
+  // The next allocation starts the profiler.
+  our_free(our_malloc(16));
+  unsetenv("SNMALLOC_HEAP_PROFILE");
+  if (!is_active())
+    abort();
+  set_active(false);
+}
+#else
+void test_deferred_start() {}
+
+void test_profile()
+{
+  bool prof = true;
+  size_t len = sizeof(prof);
+  our_mallctl("opt.prof", &prof, &len, nullptr, 0);
+#  ifdef SNMALLOC_PASS_THROUGH
+  if (prof)
+    abort();
+#  endif
+}
+#endif
+
+int main()
+{
+  setup();
+
+  test_profile();
+  test_deferred_start();
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * Tests for `AllocPool::heap_report`.
+ */
+
+#include <iostream>
+#include <snmalloc.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+#ifndef SNMALLOC_PASS_THROUGH
+HeapReport report()
+{
+  HeapReport r;
+  current_alloc_pool()->heap_report(r, ThreadAlloc::get());
+  return r;
+}
+
+void check(bool ok, const char* what)
+{
+  if (!ok)
+  {
+    std::cout << "Failed: " << what << std::endl;
+    abort();
+  }
+}
+
+/**
+ * With every allocator walked, the objects of a small sizeclass account for
+ * all of its slabs.
+ */
+void check_accounted(const HeapReport& r, sizeclass_t sc)
+{
+  auto& s = r.sizeclasses[sc];
+  check(
+    s.live_objects + s.free_objects + s.cached_objects + s.reserve_objects ==
+      s.slabs * get_slab_capacity(sc, false),
+    "small objects account for their slabs");
+}
+
+void test_small()
+{
+  const size_t size = 48;
+  const size_t count = 1000;
+  sizeclass_t sc = size_to_sizeclass(size);
+  auto* a = ThreadAlloc::get();
+
+  std::vector<void*> objects;
+  for (size_t i = 0; i < count; i++)
+    objects.push_back(a->alloc(size));
+
+  HeapReport r = report();
+  check(r.walked_allocators >= 1, "own allocator walked");
+  check(r.busy_allocators == 0, "no busy allocators");
+  check(r.sizeclasses[sc].slabs >= 1, "small slabs");
+  check(r.sizeclasses[sc].live_objects >= count, "small live objects");
+  check_accounted(r, sc);
+
+  for (auto p : objects)
+    a->dealloc(p, size);
+
+  HeapReport freed = report();
+  check_accounted(freed, sc);
+  check(
+    freed.sizeclasses[sc].live_objects < r.sizeclasses[sc].live_objects,
+    "freeing reduces live objects");
+}
+
+void test_medium()
+{
+  const size_t size = SLAB_SIZE * 2;
+  const size_t count = 3;
+  sizeclass_t sc = size_to_sizeclass(size);
+  auto* a = ThreadAlloc::get();
+
+  HeapReport before = report();
+
+  std::vector<void*> objects;
+  for (size_t i = 0; i < count; i++)
+    objects.push_back(a->alloc(size));
+
+  HeapReport r = report();
+  auto& s = r.sizeclasses[sc];
+  check(
+    s.live_objects == before.sizeclasses[sc].live_objects + count,
+    "medium live objects");
+  check(
+    s.live_objects + s.free_objects == s.slabs * medium_slab_free(sc),
+    "medium objects account for their slabs");
+
+  for (auto p : objects)
+    a->dealloc(p, size);
+}
+
+void test_large()
+{
+  const size_t size = SUPERSLAB_SIZE * 4;
+  size_t large_class = bits::next_pow2_bits(size) - SUPERSLAB_BITS;
+  auto* a = ThreadAlloc::get();
+
+  void* p = a->alloc(size);
+  HeapReport live = report();
+  check(live.large_classes[large_class].live >= 1, "large live");
+
+  a->dealloc(p, size);
+  HeapReport freed = report();
+  auto& lc = freed.large_classes[large_class];
+  check(lc.live + 1 == live.large_classes[large_class].live, "large freed");
+  check(lc.cached + lc.decommitted >= 1, "large chunk cached");
+
+  // Counting the cached chunks leaves them available for reuse.
+  HeapReport again = report();
+  check(
+    again.large_classes[large_class].cached +
+        again.large_classes[large_class].decommitted ==
+      lc.cached + lc.decommitted,
+    "large stacks restored");
+}
+
+void test_idle()
+{
+  const size_t size = 1024;
+  sizeclass_t sc = size_to_sizeclass(size);
+
+  HeapReport before = report();
+
+  // The thread's allocator returns to the pool when it exits, still owning
+  // the objects, and is walked there.
+  std::vector<void*> objects;
+  std::thread t([&objects]() {
+    for (size_t i = 0; i < 10; i++)
+      objects.push_back(ThreadAlloc::get()->alloc(size));
+  });
+  t.join();
+
+  HeapReport r = report();
+  check(r.walked_allocators > before.walked_allocators, "idle allocator");
+  check(r.busy_allocators == 0, "no busy allocators");
+  check(
+    r.sizeclasses[sc].live_objects >= before.sizeclasses[sc].live_objects + 10,
+    "idle allocator's objects");
+  check_accounted(r, sc);
+
+  for (auto p : objects)
+    ThreadAlloc::get()->dealloc(p, size);
+}
+
+void test_released()
+{
+  const size_t size = 2560;
+  sizeclass_t sc = size_to_sizeclass(size);
+
+  HeapReport before = report();
+
+  // An allocator released by an exiting thread keeps no free lists or
+  // reserves, so the slabs it freed everything from are returned.
+  std::thread t([]() {
+    auto* a = ThreadAlloc::get();
+    std::vector<void*> objects;
+    for (size_t i = 0; i < 100; i++)
+      objects.push_back(a->alloc(size));
+    for (auto p : objects)
+      a->dealloc(p, size);
+  });
+  t.join();
+
+  HeapReport r = report();
+  auto& s = r.sizeclasses[sc];
+  check(s.slabs == before.sizeclasses[sc].slabs, "released slabs");
+  check(s.cached_objects == before.sizeclasses[sc].cached_objects, "cached");
+  check(
+    s.reserve_objects == before.sizeclasses[sc].reserve_objects, "reserve");
+  check_accounted(r, sc);
+}
+#endif
+
+int main()
+{
+  setup();
+
+#ifndef SNMALLOC_PASS_THROUGH
+  test_small();
+  test_medium();
+  test_large();
+  test_idle();
+  test_released();
+#endif
+
+  return 0;
+}
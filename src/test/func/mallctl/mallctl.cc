@@ -0,0 +1,789 @@
+/**
+ * Tests for the jemalloc-compatible mallctl namespace.
+ */
+
+#include <atomic>
+#include <map>
+#include <stdio.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+#define SNMALLOC_NAME_MANGLE(a) our_##a
+#include "../../../override/malloc.cc"
+
+using namespace snmalloc;
+
+template<typename T>
+T read_ctl(const char* name)
+{
+  T value;
+  size_t len = sizeof(T);
+  int err = our_mallctl(name, &value, &len, nullptr, 0);
+  if ((err != 0) || (len != sizeof(T)))
+  {
+    printf("mallctl(\"%s\") failed with %d\n", name, err);
+    abort();
+  }
+  return value;
+}
+
+void check_err(int err, int expected, const char* what)
+{
+  if (err != expected)
+  {
+    printf("%s returned %d, expected %d\n", what, err, expected);
+    abort();
+  }
+}
+
+void test_names()
+{
+  size_t value;
+  size_t len = sizeof(value);
+
+  check_err(our_mallctl(nullptr, nullptr, nullptr, nullptr, 0), ENOENT, "null");
+  check_err(
+    our_mallctl("stats.allocatedx", &value, &len, nullptr, 0),
+    ENOENT,
+    "stats.allocatedx");
+  check_err(
+    our_mallctl("stats.allocated.x", &value, &len, nullptr, 0),
+    ENOENT,
+    "stats.allocated.x");
+  check_err(
+    our_mallctl("arena.1.purge", nullptr, nullptr, nullptr, 0),
+    ENOENT,
+    "arena.1.purge");
+  check_err(
+    our_mallctl("arenas.bin.100000.size", &value, &len, nullptr, 0),
+    ENOENT,
+    "arenas.bin.100000.size");
+
+  // A name that matches the start of one entry does not go on to match the
+  // rest of the name against another.
+  const char* malformed[] = {"stats.remote.rounds.allocator.0.slot",
+                             "stats.remote.allocator.x.rounds.0",
+                             "stats.arenas.x.allocated",
+                             "arenas.bin.x.nlextents",
+                             "arenas.narenas.nbins"};
+  for (auto m : malformed)
+    check_err(our_mallctl(m, &value, &len, nullptr, 0), ENOENT, m);
+
+  // Read-only values reject writes.
+  check_err(
+    our_mallctl("stats.allocated", nullptr, nullptr, &value, sizeof(value)),
+    EPERM,
+    "write to stats.allocated");
+
+  // A length mismatch copies what fits and reports EINVAL.
+  uint32_t small;
+  len = sizeof(small);
+  check_err(
+    our_mallctl("stats.mapped", &small, &len, nullptr, 0),
+    EINVAL,
+    "short read of stats.mapped");
+  if (len != sizeof(small))
+    abort();
+
+  const char* version = read_ctl<const char*>("version");
+  if (strcmp(version, "snmalloc") != 0)
+    abort();
+
+  uint64_t epoch = read_ctl<uint64_t>("epoch");
+  uint64_t new_epoch;
+  len = sizeof(new_epoch);
+  check_err(
+    our_mallctl("epoch", &new_epoch, &len, &epoch, sizeof(epoch)),
+    0,
+    "epoch");
+  if (new_epoch != epoch + 1)
+    abort();
+
+  if (read_ctl<unsigned>("arenas.narenas") != 1)
+    abort();
+  if (read_ctl<unsigned>("arenas.nbins") != NUM_SIZECLASSES)
+    abort();
+  if (read_ctl<unsigned>("arenas.nlextents") != NUM_LARGE_CLASSES)
+    abort();
+
+  char name[64];
+  for (sizeclass_t sc = 0; sc < NUM_SIZECLASSES; sc++)
+  {
+    snprintf(name, sizeof(name), "arenas.bin.%zu.size", size_t(sc));
+    if (read_ctl<size_t>(name) != sizeclass_to_size(sc))
+      abort();
+  }
+  for (uint8_t lc = 0; lc < NUM_LARGE_CLASSES; lc++)
+  {
+    snprintf(name, sizeof(name), "arenas.lextent.%zu.size", size_t(lc));
+    if (read_ctl<size_t>(name) != large_sizeclass_to_size(lc))
+      abort();
+  }
+
+  ptrdiff_t decay = read_ctl<ptrdiff_t>("opt.dirty_decay_ms");
+  if (read_ctl<ptrdiff_t>("arena.0.muzzy_decay_ms") != decay)
+    abort();
+  check_err(
+    our_mallctl("arenas.dirty_decay_ms", nullptr, nullptr, &decay, sizeof(decay)),
+    EPERM,
+    "write to arenas.dirty_decay_ms");
+}
+
+void test_stats()
+{
+  const size_t count = 1000;
+  const size_t size = 64;
+  const sizeclass_t sc = size_to_sizeclass(size);
+  char curregs[64];
+  snprintf(
+    curregs, sizeof(curregs), "stats.arenas.4096.bins.%zu.curregs", size_t(sc));
+
+  // Initialise this thread's allocator so that its bookkeeping allocations
+  // are already counted.
+  our_free(our_malloc(1));
+
+  size_t mapped = read_ctl<size_t>("stats.mapped");
+  size_t resident = read_ctl<size_t>("stats.resident");
+  if (resident > mapped)
+    abort();
+
+  size_t allocated_before = read_ctl<size_t>("stats.allocated");
+#if defined(USE_SNMALLOC_STATS) && !defined(SNMALLOC_PASS_THROUGH)
+  size_t curregs_before = read_ctl<size_t>(curregs);
+#endif
+
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < count; i++)
+    allocs.push_back(our_malloc(size));
+  void* large = our_malloc(SUPERSLAB_SIZE * 4);
+
+#if defined(USE_SNMALLOC_STATS) && !defined(SNMALLOC_PASS_THROUGH)
+  if (read_ctl<size_t>(curregs) != curregs_before + count)
+    abort();
+  size_t allocated = read_ctl<size_t>("stats.allocated");
+  if (allocated < allocated_before + (count * size) + (SUPERSLAB_SIZE * 4))
+    abort();
+  if (read_ctl<size_t>("stats.active") < allocated)
+    abort();
+
+  char curlextents[64];
+  snprintf(
+    curlextents,
+    sizeof(curlextents),
+    "stats.arenas.0.lextents.%zu.curlextents",
+    size_t(bits::next_pow2_bits(SUPERSLAB_SIZE * 4) - SUPERSLAB_BITS));
+  if (read_ctl<size_t>(curlextents) != 1)
+    abort();
+#else
+  UNUSED(allocated_before);
+#endif
+
+  for (auto p : allocs)
+    our_free(p);
+  our_free(large);
+
+#if defined(USE_SNMALLOC_STATS) && !defined(SNMALLOC_PASS_THROUGH)
+  if (read_ctl<size_t>(curregs) != curregs_before)
+    abort();
+  if (read_ctl<size_t>("stats.allocated") != allocated_before)
+    abort();
+#endif
+}
+
+void test_counters()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  const size_t count = 1000;
+  const size_t small_size = 48;
+  const sizeclass_t small_sc = size_to_sizeclass(small_size);
+  const size_t medium_size = SLAB_SIZE * 2;
+  const sizeclass_t medium_sc = size_to_sizeclass(medium_size);
+
+  AllocCounterTotals before;
+  current_alloc_pool()->aggregate_counters(before);
+
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < count; i++)
+    allocs.push_back(our_malloc(small_size));
+  void* medium = our_malloc(medium_size);
+
+  AllocCounterTotals during;
+  current_alloc_pool()->aggregate_counters(during);
+
+  // Refills are counted in batches, so may run ahead of the allocations.
+  if (
+    during.small_refilled[small_sc] <
+    before.small_refilled[small_sc] + count)
+    abort();
+  if (
+    during.small_slabs_allocated[small_sc] -
+      during.small_slabs_deallocated[small_sc] <
+    (count * small_size) / SLAB_SIZE)
+    abort();
+  if (
+    during.medium_allocated[medium_sc - NUM_SMALL_CLASSES] !=
+    before.medium_allocated[medium_sc - NUM_SMALL_CLASSES] + 1)
+    abort();
+  if (during.active_bytes() < before.active_bytes() + medium_size)
+    abort();
+
+  for (auto p : allocs)
+    our_free(p);
+  our_free(medium);
+
+  AllocCounterTotals after;
+  current_alloc_pool()->aggregate_counters(after);
+  if (
+    after.medium_deallocated[medium_sc - NUM_SMALL_CLASSES] !=
+    before.medium_deallocated[medium_sc - NUM_SMALL_CLASSES] + 1)
+    abort();
+#endif
+}
+
+void test_thread_bytes()
+{
+  const size_t count = 100;
+  const size_t small_size = 48;
+  const size_t medium_size = SLAB_SIZE * 2;
+  const size_t large_size = SUPERSLAB_SIZE * 3;
+
+  const uint64_t* allocatedp = read_ctl<uint64_t*>("thread.allocatedp");
+  const uint64_t* deallocatedp = read_ctl<uint64_t*>("thread.deallocatedp");
+  if (*allocatedp != read_ctl<uint64_t>("thread.allocated"))
+    abort();
+  if (*deallocatedp != read_ctl<uint64_t>("thread.deallocated"))
+    abort();
+
+  uint64_t allocated_before = *allocatedp;
+  uint64_t deallocated_before = *deallocatedp;
+
+  std::vector<void*> allocs;
+  allocs.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    allocs.push_back(our_malloc(small_size));
+  void* medium = our_malloc(medium_size);
+  void* large = our_malloc(large_size);
+
+  uint64_t expected = (count * sizeclass_to_size(size_to_sizeclass(small_size))) +
+    sizeclass_to_size(size_to_sizeclass(medium_size)) +
+    bits::next_pow2(large_size);
+
+#ifndef SNMALLOC_PASS_THROUGH
+  if (*allocatedp - allocated_before != expected)
+  {
+    fprintf(
+      stderr,
+      "thread.allocated grew by %zu, expected %zu\n",
+      size_t(*allocatedp - allocated_before),
+      size_t(expected));
+    abort();
+  }
+#endif
+
+  for (auto p : allocs)
+    our_free(p);
+  our_free(medium);
+  our_free(large);
+
+#ifndef SNMALLOC_PASS_THROUGH
+  if (*deallocatedp - deallocated_before != expected)
+  {
+    fprintf(
+      stderr,
+      "thread.deallocated grew by %zu, expected %zu\n",
+      size_t(*deallocatedp - deallocated_before),
+      size_t(expected));
+    abort();
+  }
+#endif
+
+  // A remote free is counted by the thread that frees the object.
+  void* p = nullptr;
+  std::thread t([&p]() { p = our_malloc(small_size); });
+  t.join();
+
+  deallocated_before = *deallocatedp;
+  our_free(p);
+#ifndef SNMALLOC_PASS_THROUGH
+  if (
+    *deallocatedp - deallocated_before !=
+    sizeclass_to_size(size_to_sizeclass(small_size)))
+    abort();
+#else
+  UNUSED(expected);
+  UNUSED(deallocated_before);
+#endif
+
+  // Tagged allocations are in the totals, but not behind the pointers, which
+  // are for the ordinary allocator.  Create the tagged allocator first, as
+  // it allocates its own bookkeeping.
+  our_free(our_snmalloc_tagged_malloc(small_size, 1));
+  allocated_before = read_ctl<uint64_t>("thread.allocated");
+  uint64_t allocatedp_before = *allocatedp;
+  void* tagged = our_snmalloc_tagged_malloc(small_size, 1);
+#ifndef SNMALLOC_PASS_THROUGH
+  if (
+    (read_ctl<uint64_t>("thread.allocated") - allocated_before !=
+     sizeclass_to_size(size_to_sizeclass(small_size))) ||
+    (*allocatedp != allocatedp_before))
+    abort();
+#else
+  UNUSED(allocatedp_before);
+#endif
+  our_free(tagged);
+
+  check_err(
+    our_mallctl(
+      "thread.allocated", nullptr, nullptr, &allocated_before, sizeof(uint64_t)),
+    EPERM,
+    "write to thread.allocated");
+}
+
+uint64_t latency_calls(const char* path)
+{
+  unsigned nbuckets = read_ctl<unsigned>("stats.latency.nbuckets");
+  uint64_t total = 0;
+  for (unsigned b = 0; b < nbuckets; b++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "stats.latency.%s.%u", path, b);
+    total += read_ctl<uint64_t>(name);
+  }
+  return total;
+}
+
+void test_latency()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  check_err(
+    our_mallctl("stats.latency.alloc_slab.1000", nullptr, nullptr, nullptr, 0),
+    ENOENT,
+    "out of range latency bucket");
+
+  uint64_t before = latency_calls("large_alloc");
+  our_free(our_malloc(SUPERSLAB_SIZE * 4));
+  if (latency_calls("large_alloc") != before)
+    abort();
+
+  bool on = true;
+  bool was_on = true;
+  size_t len = sizeof(was_on);
+  check_err(
+    our_mallctl("stats.latency.active", &was_on, &len, &on, sizeof(on)),
+    0,
+    "enable latency histograms");
+  if (was_on || !read_ctl<bool>("stats.latency.active"))
+    abort();
+
+  const size_t n = 4;
+  for (size_t i = 0; i < n; i++)
+    our_free(our_malloc(SUPERSLAB_SIZE * 4));
+  if (latency_calls("large_alloc") != before + n)
+  {
+    fprintf(
+      stderr,
+      "large_alloc latency has %zu calls, expected %zu\n",
+      static_cast<size_t>(latency_calls("large_alloc")),
+      static_cast<size_t>(before + n));
+    abort();
+  }
+
+  on = false;
+  our_mallctl("stats.latency.active", nullptr, nullptr, &on, sizeof(on));
+#endif
+}
+
+void test_remote_bytes()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  const size_t count = 100;
+  const size_t size = 48;
+  const size_t bytes = count * sizeclass_to_size(size_to_sizeclass(size));
+
+  std::vector<void*> allocs;
+  std::thread t([&allocs]() {
+    for (size_t i = 0; i < count + 1; i++)
+      allocs.push_back(our_malloc(size));
+  });
+  t.join();
+
+  // The first remote free may post immediately, as the remote cache starts
+  // empty.
+  our_free(allocs.back());
+  allocs.pop_back();
+  our_mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0);
+
+  size_t cached = read_ctl<size_t>("stats.remote.cached");
+  size_t queued = read_ctl<size_t>("stats.remote.queued");
+
+  for (auto p : allocs)
+    our_free(p);
+
+  if (read_ctl<size_t>("stats.remote.cached") != cached + bytes)
+  {
+    fprintf(
+      stderr,
+      "stats.remote.cached is %zu, expected %zu\n",
+      read_ctl<size_t>("stats.remote.cached"),
+      cached + bytes);
+    abort();
+  }
+
+  // The owner has exited, so the objects stay in its message queue.
+  our_mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0);
+  if (read_ctl<size_t>("stats.remote.cached") != cached)
+    abort();
+  if (read_ctl<size_t>("stats.remote.queued") != queued + bytes)
+  {
+    fprintf(
+      stderr,
+      "stats.remote.queued is %zu, expected %zu\n",
+      read_ctl<size_t>("stats.remote.queued"),
+      queued + bytes);
+    abort();
+  }
+#endif
+}
+
+void test_remote_reclaim()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  const size_t count = 100;
+  const size_t size = 48;
+  size_t capacity = get_slab_capacity(size_to_sizeclass(size), false);
+
+  std::vector<void*> remote;
+  for (size_t i = 0; i < count; i++)
+    remote.push_back(our_malloc(size));
+  std::vector<void*> local;
+  for (size_t i = 0; i < capacity * 2; i++)
+    local.push_back(our_malloc(size));
+
+  // Another thread frees this thread's objects, and flushes them to this
+  // thread without exiting.  It may reuse an allocator with messages
+  // queued for it, so it takes its allocator and flushes those first.
+  our_snmalloc_thread_flush();
+  std::atomic<int> phase{0};
+  std::thread t([&]() {
+    our_free(our_malloc(size));
+    our_snmalloc_thread_flush();
+    phase = 1;
+    while (phase != 2)
+      std::this_thread::yield();
+    for (auto p : remote)
+      our_free(p);
+    our_snmalloc_thread_flush();
+    phase = 3;
+    while (phase != 4)
+      std::this_thread::yield();
+  });
+  while (phase != 1)
+    std::this_thread::yield();
+  // Each allocator counts the stub of its queue as received, so the total
+  // queued can be clamped at zero; count the messages received instead.
+  size_t queued = read_ctl<size_t>("stats.remote.queued");
+  uint64_t received = mallctl::aggregate_counters().remote_received;
+  phase = 2;
+  while (phase != 3)
+    std::this_thread::yield();
+
+  if (read_ctl<size_t>("stats.remote.queued") <= queued)
+  {
+    fprintf(stderr, "stats.remote.queued did not grow on flush\n");
+    abort();
+  }
+
+  // Freeing, without allocating, processes the queue on a slow path.
+  for (auto p : local)
+    our_free(p);
+  received = mallctl::aggregate_counters().remote_received - received;
+  if (received < count)
+  {
+    fprintf(
+      stderr,
+      "%zu messages received after local frees, expected %zu\n",
+      static_cast<size_t>(received),
+      count);
+    abort();
+  }
+
+  phase = 4;
+  t.join();
+#endif
+}
+
+uint64_t remote_sent_total()
+{
+  unsigned n = read_ctl<unsigned>("stats.remote.nallocators");
+  unsigned slots = read_ctl<unsigned>("stats.remote.slots");
+  uint64_t total = 0;
+  for (unsigned i = 0; i < n; i++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "stats.remote.allocator.%u.slot", i);
+    if (read_ctl<unsigned>(name) >= slots)
+      abort();
+    for (unsigned s = 0; s < slots; s++)
+    {
+      snprintf(name, sizeof(name), "stats.remote.allocator.%u.sent.%u", i, s);
+      total += read_ctl<uint64_t>(name);
+    }
+  }
+  return total;
+}
+
+void test_remote_traffic()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  const size_t count = 50;
+
+  check_err(
+    our_mallctl("stats.remote.rounds.1000", nullptr, nullptr, nullptr, 0),
+    ENOENT,
+    "out of range post round bucket");
+  check_err(
+    our_mallctl(
+      "stats.remote.allocator.4000.slot", nullptr, nullptr, nullptr, 0),
+    ENOENT,
+    "out of range allocator");
+
+  std::vector<void*> allocs;
+  std::thread t([&allocs]() {
+    for (size_t i = 0; i < count; i++)
+      allocs.push_back(our_malloc(48));
+  });
+  t.join();
+
+  uint64_t sent = remote_sent_total();
+  for (auto p : allocs)
+    our_free(p);
+
+  if (remote_sent_total() != sent + count)
+  {
+    fprintf(
+      stderr,
+      "remote frees sent grew by %zu, expected %zu\n",
+      static_cast<size_t>(remote_sent_total() - sent),
+      count);
+    abort();
+  }
+
+  // Posting the cache is counted in one of the round buckets.  Flushing
+  // also posts the caches of the thread's tagged allocators.
+  uint64_t posts = 0;
+  for (unsigned r = 0; r < NUM_POST_ROUND_BUCKETS; r++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "stats.remote.rounds.%u", r);
+    posts += read_ctl<uint64_t>(name);
+  }
+  our_mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0);
+  uint64_t posts_after = 0;
+  for (unsigned r = 0; r < NUM_POST_ROUND_BUCKETS; r++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "stats.remote.rounds.%u", r);
+    posts_after += read_ctl<uint64_t>(name);
+  }
+  if (posts_after <= posts)
+    abort();
+#endif
+}
+
+void test_heap_dump()
+{
+  const char* path = nullptr;
+  size_t len = sizeof(path);
+  check_err(
+    our_mallctl("stats.heap.dump", &path, &len, nullptr, 0),
+    EPERM,
+    "read of stats.heap.dump");
+
+#if !defined(SNMALLOC_PASS_THROUGH) && defined(__unix__)
+  char file[] = "/tmp/snmalloc_heap_report_XXXXXX";
+  int fd = mkstemp(file);
+  if (fd < 0)
+    abort();
+  close(fd);
+
+  void* p = our_malloc(48);
+  path = file;
+  check_err(
+    our_mallctl("stats.heap.dump", nullptr, nullptr, &path, sizeof(path)),
+    0,
+    "stats.heap.dump");
+  our_free(p);
+
+  char buffer[64] = {};
+  FILE* f = fopen(file, "r");
+  if ((f == nullptr) || (fgets(buffer, sizeof(buffer), f) == nullptr))
+    abort();
+  fclose(f);
+  unlink(file);
+  if (strncmp(buffer, "{\"walked_allocators\":", 21) != 0)
+  {
+    fprintf(stderr, "Unexpected heap report: %s\n", buffer);
+    abort();
+  }
+#endif
+}
+
+SlabUtilization query(void* p)
+{
+  SlabUtilization u;
+  size_t len = sizeof(u);
+  check_err(
+    our_mallctl("experimental.utilization.query", &u, &len, &p, sizeof(p)),
+    0,
+    "experimental.utilization.query");
+  return u;
+}
+
+void test_defrag_hint()
+{
+  void* large = our_malloc(SUPERSLAB_SIZE * 4);
+  SlabUtilization u = query(large);
+  if (
+    (u.nfree != 0) || (u.nregs != 1) ||
+    (u.size != our_malloc_usable_size(large)))
+    abort();
+  if (our_snmalloc_defrag_hint(large) != 0)
+    abort();
+  our_free(large);
+
+#ifndef SNMALLOC_PASS_THROUGH
+  // Fill several slabs, then keep all of the objects in one slab, and one
+  // object in each of the others.
+  const size_t size = 48;
+  sizeclass_t sc = size_to_sizeclass(size);
+  size_t capacity = get_slab_capacity(sc, false);
+  std::vector<void*> objects;
+  for (size_t i = 0; i < capacity * 4; i++)
+    objects.push_back(our_malloc(size));
+
+  auto slab_of = [](void* p) { return address_cast(p) >> SLAB_BITS; };
+  std::map<address_t, std::vector<void*>> slabs;
+  for (auto p : objects)
+    slabs[slab_of(p)].push_back(p);
+
+  std::vector<void*> dense;
+  std::vector<void*> sparse;
+  for (auto& [slab, ps] : slabs)
+  {
+    if (dense.empty() && (ps.size() == capacity))
+    {
+      dense = ps;
+      continue;
+    }
+    sparse.push_back(ps[0]);
+    for (size_t i = 1; i < ps.size(); i++)
+      our_free(ps[i]);
+  }
+  if (dense.empty() || (sparse.size() < 3))
+    abort();
+
+  u = query(dense[0]);
+  if ((u.nfree != 0) || (u.size != sizeclass_to_size(sc)))
+    abort();
+  if (our_snmalloc_defrag_hint(dense[0]) != 0)
+    abort();
+
+  // At most one sparse slab is being used by the fast path, and one is next
+  // in line, so at least one can be emptied.
+  size_t moved = 0;
+  for (auto& p : sparse)
+  {
+    u = query(p);
+    if (u.nfree >= u.nregs)
+      abort();
+    if (our_snmalloc_defrag_hint(p) == 0)
+      continue;
+    if ((u.nfree == 0) || (u.bin_nfree == 0))
+      abort();
+
+    void* copy = our_malloc(size);
+    if (slab_of(copy) == slab_of(p))
+    {
+      fprintf(stderr, "Moved object stayed in its slab\n");
+      abort();
+    }
+    our_free(p);
+    p = copy;
+    moved++;
+  }
+  if (moved == 0)
+  {
+    fprintf(stderr, "No sparse slab was hinted\n");
+    abort();
+  }
+
+  for (auto p : sparse)
+    our_free(p);
+  for (auto p : dense)
+    our_free(p);
+#endif
+}
+
+void test_commands()
+{
+  // Free an allocation owned by another thread, so that this thread has
+  // something to flush.
+  void* p = nullptr;
+  std::thread t([&p]() { p = our_malloc(48); });
+  t.join();
+  our_free(p);
+
+  check_err(
+    our_mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0),
+    0,
+    "thread.tcache.flush");
+
+  size_t value;
+  size_t len = sizeof(value);
+  check_err(
+    our_mallctl("thread.tcache.flush", &value, &len, nullptr, 0),
+    EPERM,
+    "read of thread.tcache.flush");
+
+  void* large = our_malloc(SUPERSLAB_SIZE * 2);
+  our_free(large);
+
+  check_err(
+    our_mallctl("arena.0.purge", nullptr, nullptr, nullptr, 0),
+    0,
+    "arena.0.purge");
+  check_err(
+    our_mallctl("arena.4096.decay", nullptr, nullptr, nullptr, 0),
+    0,
+    "arena.4096.decay");
+
+  // Memory must still be usable after it has been purged.
+  large = our_calloc(1, SUPERSLAB_SIZE * 2);
+  for (size_t i = 0; i < SUPERSLAB_SIZE * 2; i += OS_PAGE_SIZE)
+  {
+    if (static_cast<char*>(large)[i] != 0)
+      abort();
+  }
+  memset(large, 0xa5, SUPERSLAB_SIZE * 2);
+  our_free(large);
+}
+
+int main()
+{
+  setup();
+
+  test_names();
+  test_stats();
+  test_counters();
+  test_thread_bytes();
+  test_remote_bytes();
+  test_remote_traffic();
+  test_remote_reclaim();
+  test_latency();
+  test_heap_dump();
+  test_defrag_hint();
+  test_commands();
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <test/setup.h>
+#include <thread>
+#include <vector>
 
 #define SNMALLOC_NAME_MANGLE(a) our_##a
 #include "../../../override/malloc.cc"
@@ -116,6 +118,141 @@ void test_memalign(size_t size, size_t align, int err, bool null)
   check_result(size, align, p, err, null);
 }
 
+void check_allocx(void* p, size_t size, size_t align, int flags)
+{
+  if (p == nullptr)
+  {
+    printf("mallocx(%zu, %d) failed.\n", size, flags);
+    abort();
+  }
+
+  const auto alloc_size = our_sallocx(p, flags);
+  const auto expected_size = our_nallocx(size, flags);
+#ifdef SNMALLOC_PASS_THROUGH
+  const auto exact_size = false;
+#else
+  const auto exact_size = true;
+#endif
+  if (
+    (alloc_size < expected_size) ||
+    (exact_size && (alloc_size != expected_size)))
+  {
+    printf(
+      "Usable size is %zu, but nallocx reports %zu.\n",
+      alloc_size,
+      expected_size);
+    abort();
+  }
+  if (static_cast<size_t>(reinterpret_cast<uintptr_t>(p) % align) != 0)
+  {
+    printf(
+      "Address is 0x%zx, but required to be aligned to 0x%zx.\n",
+      reinterpret_cast<size_t>(p),
+      align);
+    abort();
+  }
+}
+
+void test_mallocx(size_t size, size_t align)
+{
+  fprintf(stderr, "mallocx(%zu, MALLOCX_ALIGN(%zu))\n", size, align);
+  int flags = MALLOCX_ALIGN(align);
+
+  void* p = our_mallocx(size, flags | MALLOCX_ZERO);
+  check_allocx(p, size, align, flags);
+  for (size_t i = 0; i < size; i++)
+  {
+    if (((uint8_t*)p)[i] != 0)
+      abort();
+  }
+  memset(p, 0xa5, size);
+  our_sdallocx(p, size, flags);
+
+  p = our_mallocx(size, flags);
+  check_allocx(p, size, align, flags);
+  if (our_xallocx(p, size, 0, flags) != our_sallocx(p, flags))
+    abort();
+  // Sized deallocation must accept any size up to the usable size.
+  our_sdallocx(p, our_sallocx(p, flags), flags);
+}
+
+void test_rallocx(size_t size, size_t new_size, size_t align)
+{
+  fprintf(
+    stderr,
+    "rallocx(mallocx(%zu), %zu, MALLOCX_ALIGN(%zu) | MALLOCX_ZERO)\n",
+    size,
+    new_size,
+    align);
+  int flags = MALLOCX_ALIGN(align);
+
+  uint8_t* p = (uint8_t*)our_mallocx(size, flags);
+  check_allocx(p, size, align, flags);
+  size_t old_usable = our_sallocx(p, flags);
+  memset(p, 0xa5, old_usable);
+
+  uint8_t* q = (uint8_t*)our_rallocx(p, new_size, flags | MALLOCX_ZERO);
+  check_allocx(q, new_size, align, flags);
+  for (size_t i = 0; i < bits::min(old_usable, new_size); i++)
+  {
+    if (q[i] != 0xa5)
+      abort();
+  }
+  for (size_t i = old_usable; i < new_size; i++)
+  {
+    if (q[i] != 0)
+      abort();
+  }
+  our_dallocx(q, flags);
+}
+
+void test_alloc_at_least(size_t size)
+{
+  fprintf(stderr, "alloc_at_least(%zu)\n", size);
+  auto a = ThreadAlloc::get();
+  auto [p, usable] = a->alloc_at_least(size);
+  if ((p == nullptr) || (usable < size))
+    abort();
+  if (usable != our_malloc_usable_size(p))
+    abort();
+  memset(p, 0xa5, usable);
+  a->dealloc(p, usable);
+}
+
+void test_trim()
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  // Objects freed into a new allocator's slabs leave the slab it is bump
+  // allocating from in use until trimmed.  Fill more than one superslab, as
+  // the first holds the allocator's message queue stub.
+  auto a = current_alloc_pool()->acquire_new();
+  const size_t size = 1024;
+  std::vector<void*> objects;
+  for (size_t i = 0; i < 2 * SUPERSLAB_SIZE / size; i++)
+    objects.push_back(a->alloc(size));
+  for (auto p : objects)
+    a->dealloc(p, size);
+
+  size_t released = a->trim();
+  fprintf(stderr, "trim released %zu bytes\n", released);
+  if (released == 0)
+    abort();
+  current_alloc_pool()->release(a);
+#endif
+
+  // Trimming with nothing to release is harmless.
+  our_snmalloc_trim();
+  if (our_malloc_trim(0) > 1)
+    abort();
+
+  // So is trimming from a thread that has not allocated yet.
+  std::thread([]() { our_snmalloc_trim(); }).join();
+  std::thread([]() {
+    if (our_malloc_trim(0) > 1)
+      abort();
+  }).join();
+}
+
 int main(int argc, char** argv)
 {
   UNUSED(argc);
@@ -203,6 +340,32 @@ int main(int argc, char** argv)
     test_posix_memalign(0, align + 1, EINVAL, true);
   }
 
+  for (size_t align = 1; align <= SUPERSLAB_SIZE * 2; align <<= 3)
+  {
+    for (sizeclass_t sc = 0; sc < (SUPERSLAB_BITS + 2); sc += 3)
+    {
+      const size_t size = bits::one_at_bit(sc);
+      test_mallocx(size, align);
+      test_mallocx(size + 1, align);
+      test_rallocx(size, size * 3, align);
+      test_rallocx(size + 1, size / 2 + 1, align);
+    }
+  }
+
+  if (our_nallocx((size_t)-1, 0) != 0)
+    abort();
+  errno = 0;
+  if ((our_mallocx((size_t)-1, 0) != nullptr) || (errno != ENOMEM))
+    abort();
+
+  for (sizeclass_t sc = 0; sc < (SUPERSLAB_BITS + 2); sc++)
+  {
+    test_alloc_at_least(bits::one_at_bit(sc) - 1);
+    test_alloc_at_least(bits::one_at_bit(sc) + 1);
+  }
+
+  test_trim();
+
   current_alloc_pool()->debug_check_empty();
   return 0;
 }
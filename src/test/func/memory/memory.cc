@@ -4,6 +4,7 @@
 #include <test/setup.h>
 #include <test/xoroshiro.h>
 #include <unordered_set>
+#include <vector>
 #if defined(__linux__) && !defined(SNMALLOC_QEMU_WORKAROUND)
 /*
  * We only test allocations with limited AS on linux for now.
@@ -228,6 +229,34 @@ void test_double_alloc()
   current_alloc_pool()->debug_check_empty();
 }
 
+void test_remote_dealloc_shuffled()
+{
+  auto* a1 = current_alloc_pool()->acquire();
+  auto* a2 = current_alloc_pool()->acquire();
+
+  // Objects of several sizeclasses, interleaved across slabs, so that the
+  // owner handles runs of objects in the same slab and runs that free their
+  // slab.
+  const size_t sizes[] = {16, 48, 256, 1024, SLAB_SIZE * 2};
+  std::vector<std::pair<void*, size_t>> objects;
+  for (size_t i = 0; i < 4096; i++)
+  {
+    size_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+    objects.emplace_back(a1->alloc(size), size);
+  }
+
+  xoroshiro::p128r32 r;
+  for (size_t i = objects.size() - 1; i > 0; i--)
+    std::swap(objects[i], objects[r.next() % (i + 1)]);
+
+  for (auto& [p, size] : objects)
+    a2->dealloc(p, size);
+
+  current_alloc_pool()->release(a2);
+  current_alloc_pool()->release(a1);
+  current_alloc_pool()->debug_check_empty();
+}
+
 void test_external_pointer()
 {
   // Malloc does not have an external pointer querying mechanism.
@@ -450,6 +479,7 @@ int main(int argc, char** argv)
   test_random_allocation();
   test_calloc();
   test_double_alloc();
+  test_remote_dealloc_shuffled();
 #ifndef SNMALLOC_PASS_THROUGH // Depends on snmalloc specific features
   test_static_sized_allocs();
   test_calloc_large_bug();
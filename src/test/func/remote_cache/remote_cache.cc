@@ -0,0 +1,150 @@
+/**
+ * Tests for the adaptive sizing of remote caches.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <snmalloc.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+#ifndef SNMALLOC_PASS_THROUGH
+void check(bool ok, const char* what)
+{
+  if (!ok)
+  {
+    std::cout << "Failed: " << what << std::endl;
+    abort();
+  }
+}
+
+/**
+ * Allocate `count` objects of `size` bytes from a thread that then exits, so
+ * that freeing them from this thread is a remote deallocation.
+ */
+std::vector<void*> remote_objects(size_t size, size_t count)
+{
+  std::vector<void*> objects;
+  std::thread t([&objects, size, count]() {
+    auto* a = ThreadAlloc::get();
+    for (size_t i = 0; i < count; i++)
+      objects.push_back(a->alloc(size));
+  });
+  t.join();
+  return objects;
+}
+
+/**
+ * Each allocator in use gets a smaller share of `REMOTE_CACHE_SHARED`.
+ */
+void test_share()
+{
+  const size_t threads = 64;
+  int64_t alone = RemoteCacheShare::share();
+
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> done{false};
+  std::vector<std::thread> ts;
+  for (size_t i = 0; i < threads; i++)
+  {
+    ts.emplace_back([&ready, &done]() {
+      auto* a = ThreadAlloc::get();
+      a->dealloc(a->alloc(16));
+      ready++;
+      while (!done)
+        std::this_thread::yield();
+    });
+  }
+  while (ready != threads)
+    std::this_thread::yield();
+
+  int64_t crowded = RemoteCacheShare::share();
+  check(crowded < alone, "share shrinks");
+  check(
+    crowded <=
+      bits::max(
+        REMOTE_CACHE_MIN, REMOTE_CACHE_SHARED / static_cast<int64_t>(threads)),
+    "share divides REMOTE_CACHE_SHARED");
+
+  done = true;
+  for (auto& t : ts)
+    t.join();
+
+  check(RemoteCacheShare::share() == alone, "share restored");
+}
+
+/**
+ * A new allocator's cache is empty, so it is neither aged nor posted, and its
+ * limit does not grow.
+ */
+void test_empty()
+{
+  const size_t large = SUPERSLAB_SIZE;
+  auto* a = current_alloc_pool()->acquire_new();
+  int64_t limit = a->remote_cache_limit();
+  uint64_t posts = a->counters().remote_posts;
+
+  for (size_t i = 0; i < REMOTE_CACHE_MAX_AGE * 2; i++)
+    a->dealloc(a->alloc(large));
+  a->flush();
+
+  check(a->counters().remote_posts == posts, "empty cache not posted");
+  check(a->remote_cache_limit() == limit, "empty cache limit unchanged");
+
+  current_alloc_pool()->release(a);
+  check(a->counters().remote_posts == posts, "empty cache not reclaimed");
+}
+
+/**
+ * A cache that goes stale before it fills shrinks, and one that fills
+ * quickly grows back.
+ */
+void test_adapt()
+{
+  const size_t size = 1024;
+  const size_t large = SUPERSLAB_SIZE;
+  auto* a = ThreadAlloc::get();
+  auto objects = remote_objects(size, REMOTE_CACHE / size * 4);
+
+  // Post the cache, so that it starts at its full size.
+  a->dealloc(objects.back());
+  objects.pop_back();
+  a->flush();
+  int64_t full = a->remote_cache_limit();
+
+  // Free one remote object per REMOTE_CACHE_MAX_AGE slow paths.
+  for (size_t round = 0; round < 3; round++)
+  {
+    a->dealloc(objects.back());
+    objects.pop_back();
+    for (size_t i = 0; i < REMOTE_CACHE_MAX_AGE; i++)
+      a->dealloc(a->alloc(large));
+  }
+  int64_t stale = a->remote_cache_limit();
+  check(stale < full, "stale cache shrinks");
+  check(stale >= REMOTE_CACHE_MIN, "cache keeps its minimum");
+
+  // Free the rest without any other slow paths.
+  for (auto p : objects)
+    a->dealloc(p);
+  check(a->remote_cache_limit() > stale, "busy cache grows");
+
+  a->flush();
+}
+#endif
+
+int main()
+{
+  setup();
+
+#ifndef SNMALLOC_PASS_THROUGH
+  test_share();
+  test_empty();
+  test_adapt();
+#endif
+
+  return 0;
+}
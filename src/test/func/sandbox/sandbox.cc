@@ -161,6 +161,17 @@ namespace
         real_state->push_large_stack(slab, large_class);
       }
 
+      /**
+       * Decommit a chunk that is about to be pushed to the large stack,
+       * proxies to the real implementation.
+       *
+       * This method must be implemented for `LargeAlloc` to work.
+       */
+      void decommit_chunk(CapPtr<Largeslab, CBChunk> p, size_t rsize)
+      {
+        real_state->decommit_chunk(p, rsize);
+      }
+
       /**
        * Reserve (and optionally commit) memory for a large sizeclass, proxies
        * to the real implementation.
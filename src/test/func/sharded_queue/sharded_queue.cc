@@ -0,0 +1,77 @@
+/**
+ * Tests for sharded message queues: many threads free the objects of one
+ * allocator, and all of them are returned to it.
+ */
+
+#define USE_REMOTE_QUEUE_SHARDS 4
+
+#include <atomic>
+#include <iostream>
+#include <snmalloc.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+#ifndef SNMALLOC_PASS_THROUGH
+void check(bool ok, const char* what)
+{
+  if (!ok)
+  {
+    std::cout << "Failed: " << what << std::endl;
+    abort();
+  }
+}
+
+void test_fan_in()
+{
+  const size_t threads = 16;
+  const size_t per_thread = 1000;
+  const size_t size = 64;
+  auto* a = ThreadAlloc::get();
+
+  std::vector<void*> objects;
+  for (size_t i = 0; i < threads * per_thread; i++)
+    objects.push_back(a->alloc(size));
+
+  uint64_t received = a->counters().remote_received;
+
+  std::vector<std::thread> ts;
+  for (size_t t = 0; t < threads; t++)
+  {
+    ts.emplace_back([&objects, t]() {
+      auto* b = ThreadAlloc::get();
+      for (size_t i = t * per_thread; i < (t + 1) * per_thread; i++)
+        b->dealloc(objects[i], size);
+      b->flush();
+    });
+  }
+  for (auto& t : ts)
+    t.join();
+
+  // Each flush handles one batch, taking from the shards in turn.
+  for (size_t i = 0; i < 64; i++)
+  {
+    if (a->counters().remote_received - received >= threads * per_thread)
+      break;
+    a->flush();
+  }
+  check(
+    a->counters().remote_received - received >= threads * per_thread,
+    "every shard drained");
+
+  current_alloc_pool()->debug_check_empty();
+}
+#endif
+
+int main()
+{
+  setup();
+
+#ifndef SNMALLOC_PASS_THROUGH
+  test_fan_in();
+#endif
+
+  return 0;
+}
@@ -0,0 +1,238 @@
+/**
+ * Tests for the periodic statistics exporter.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <test/setup.h>
+#include <vector>
+
+#define SNMALLOC_NAME_MANGLE(a) our_##a
+#include "../../../override/malloc.cc"
+
+using namespace snmalloc;
+
+#ifdef SNMALLOC_STATS_EXPORT
+#  include <stdlib.h>
+#  include <unistd.h>
+
+std::string read_all(int fd)
+{
+  std::string result;
+  char buffer[4096];
+  lseek(fd, 0, SEEK_SET);
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    result.append(buffer, static_cast<size_t>(n));
+  return result;
+}
+
+std::vector<std::string> lines(const std::string& s)
+{
+  std::vector<std::string> result;
+  size_t start = 0;
+  size_t end;
+  while ((end = s.find('\n', start)) != std::string::npos)
+  {
+    result.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+  if (start != s.size())
+  {
+    fprintf(stderr, "Unterminated line: %s\n", s.substr(start).c_str());
+    abort();
+  }
+  return result;
+}
+
+int make_temp_file()
+{
+  char path[] = "/tmp/snmalloc-stats-export-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    abort();
+  unlink(path);
+  return fd;
+}
+
+void churn()
+{
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < 10000; i++)
+    allocs.push_back(our_malloc(32 + (i % 100)));
+  allocs.push_back(our_malloc(SUPERSLAB_SIZE * 2));
+  for (auto p : allocs)
+    our_free(p);
+}
+
+void sleep_ms(unsigned ms)
+{
+  usleep(ms * 1000);
+}
+
+void test_json()
+{
+  int fd = make_temp_file();
+
+  if (our_snmalloc_stats_export_start(fd, 5, 0) != 0)
+    abort();
+  // Only one exporter may run at a time.
+  if (our_snmalloc_stats_export_start(fd, 5, 0) != EBUSY)
+    abort();
+
+  churn();
+  sleep_ms(30);
+  churn();
+  our_snmalloc_stats_export_stop();
+
+  auto output = lines(read_all(fd));
+  close(fd);
+
+  // At least the first snapshot and the final one.
+  if (output.size() < 2)
+    abort();
+
+  size_t large_allocs = 0;
+  for (size_t i = 0; i < output.size(); i++)
+  {
+    auto& line = output[i];
+    fprintf(stderr, "%s\n", line.c_str());
+    if ((line.front() != '{') || (line.back() != '}'))
+      abort();
+
+    std::string seq = "{\"seq\":" + std::to_string(i) + ",";
+    if (line.compare(0, seq.size(), seq) != 0)
+      abort();
+
+    for (auto key : {"\"resident\":",
+                     "\"active\":",
+                     "\"remote_posts\":",
+                     "\"small_slabs_by_class\":["})
+    {
+      if (line.find(key) == std::string::npos)
+        abort();
+    }
+
+    // Counters are deltas, so their sum over all snapshots covers the
+    // allocations made while the exporter was running.
+    auto pos = line.find("\"large_allocs\":");
+    large_allocs += strtoull(line.c_str() + pos + 15, nullptr, 10);
+  }
+
+#ifndef SNMALLOC_PASS_THROUGH
+  if (large_allocs < 2)
+    abort();
+#else
+  UNUSED(large_allocs);
+#endif
+}
+
+void test_csv()
+{
+  int fd = make_temp_file();
+
+  if (our_snmalloc_stats_export_start(fd, 1000, 1) != 0)
+    abort();
+  churn();
+  our_snmalloc_stats_export_stop();
+
+  auto output = lines(read_all(fd));
+  close(fd);
+
+  // Header, first snapshot, final snapshot.
+  if (output.size() != 3)
+    abort();
+
+  if (output[0].compare(0, 20, "SnapshotStats, seq, ") != 0)
+    abort();
+
+  auto columns = [](const std::string& line) {
+    size_t n = 1;
+    for (auto c : line)
+      n += (c == ',') ? 1 : 0;
+    return n;
+  };
+
+  for (auto& line : output)
+  {
+    fprintf(stderr, "%s\n", line.c_str());
+    if (line.compare(0, 15, "SnapshotStats, ") != 0)
+      abort();
+    if (columns(line) != columns(output[0]))
+      abort();
+  }
+}
+
+void test_csv_append()
+{
+  int fd = make_temp_file();
+
+  // Each run writes its own header, even when appending.
+  for (size_t run = 0; run < 2; run++)
+  {
+    if (our_snmalloc_stats_export_start(fd, 1000, 1) != 0)
+      abort();
+    our_snmalloc_stats_export_stop();
+  }
+
+  auto output = lines(read_all(fd));
+  close(fd);
+
+  if (output.size() != 6)
+    abort();
+  for (size_t i = 0; i < output.size(); i++)
+  {
+    bool header = output[i].compare(0, 20, "SnapshotStats, seq, ") == 0;
+    if (header != ((i % 3) == 0))
+      abort();
+  }
+}
+
+#  ifndef SNMALLOC_PASS_THROUGH
+void test_deferred_start()
+{
+  int fd = make_temp_file();
+  std::string target = "fd:" + std::to_string(fd);
+  setenv("SNMALLOC_STATS_EXPORT", target.c_str(), 1);
+  setenv("SNMALLOC_STATS_EXPORT_INTERVAL_MS", "1000", 1);
+
+  if (!StatsExporter::defer_start_from_environment())
+    abort();
+
+  // The next allocation starts the exporter.
+  our_free(our_malloc(16));
+  unsetenv("SNMALLOC_STATS_EXPORT");
+  if (our_snmalloc_stats_export_start(fd, 1000, 0) != EBUSY)
+    abort();
+  our_snmalloc_stats_export_stop();
+  close(fd);
+}
+#  endif
+
+void test_errors()
+{
+  if (our_snmalloc_stats_export_start(-1, 10, 0) != EINVAL)
+    abort();
+  if (our_snmalloc_stats_export_start(1, 0, 0) != EINVAL)
+    abort();
+  // Stopping when not running is harmless.
+  our_snmalloc_stats_export_stop();
+}
+#endif
+
+int main()
+{
+  setup();
+
+#ifdef SNMALLOC_STATS_EXPORT
+  test_errors();
+  test_json();
+  test_csv();
+  test_csv_append();
+#  ifndef SNMALLOC_PASS_THROUGH
+  test_deferred_start();
+#  endif
+#endif
+
+  return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * Tests for allocation tags.
+ */
+
+#include <stdio.h>
+#include <test/setup.h>
+#include <thread>
+#include <vector>
+
+#define SNMALLOC_NAME_MANGLE(a) our_##a
+#include "../../../override/malloc.cc"
+
+using namespace snmalloc;
+
+size_t live(unsigned tag)
+{
+  return our_snmalloc_tag_live_bytes(tag);
+}
+
+/**
+ * Process outstanding remote frees, including any that are forwarded
+ * between this thread's allocators.
+ */
+void flush()
+{
+  for (size_t i = 0; i < 4; i++)
+    our_mallctl("thread.tcache.flush", nullptr, nullptr, nullptr, 0);
+}
+
+void check_live(unsigned tag, size_t expected, const char* what)
+{
+#ifndef SNMALLOC_PASS_THROUGH
+  size_t l = live(tag);
+  if (l != expected)
+  {
+    fprintf(stderr, "%s: tag %u has %zu live bytes, expected %zu\n", what, tag, l, expected);
+    abort();
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "stats.tags.%u.live", tag);
+  size_t value;
+  size_t len = sizeof(value);
+  if ((our_mallctl(name, &value, &len, nullptr, 0) != 0) || (value != l))
+    abort();
+#else
+  UNUSED(tag);
+  UNUSED(expected);
+  UNUSED(what);
+#endif
+}
+
+void test_api()
+{
+  unsigned ntags;
+  size_t len = sizeof(ntags);
+  if (our_mallctl("arenas.ntags", &ntags, &len, nullptr, 0) != 0)
+    abort();
+  if (ntags != NUM_ALLOC_TAGS)
+    abort();
+
+  errno = 0;
+  if (our_snmalloc_tagged_malloc(16, ntags) != nullptr)
+    abort();
+  if (errno != EINVAL)
+    abort();
+  if (our_snmalloc_tag_live_bytes(ntags) != 0)
+    abort();
+
+  // Tag 0 is the ordinary allocator.
+  void* p = our_snmalloc_tagged_malloc(16, 0);
+  if (ThreadAlloc::get()->alloc_size(p) == 0)
+    abort();
+  our_free(p);
+
+  char* z = static_cast<char*>(our_snmalloc_tagged_calloc(100, 10, 1));
+  for (size_t i = 0; i < 1000; i++)
+  {
+    if (z[i] != 0)
+      abort();
+  }
+  our_free(z);
+  flush();
+}
+
+void test_local()
+{
+  const size_t count = 200;
+  const size_t small_size = 48;
+  const size_t medium_size = SLAB_SIZE * 2;
+  const size_t large_size = SUPERSLAB_SIZE * 2;
+
+  size_t live1 = live(1);
+  size_t live2 = live(2);
+
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < count; i++)
+    allocs.push_back(our_snmalloc_tagged_malloc(small_size, 1));
+  void* medium = our_snmalloc_tagged_malloc(medium_size, 1);
+  void* large = our_snmalloc_tagged_malloc(large_size, 1);
+  void* other = our_snmalloc_tagged_malloc(small_size, 2);
+
+  size_t expected = (count * sizeclass_to_size(size_to_sizeclass(small_size))) +
+    sizeclass_to_size(size_to_sizeclass(medium_size)) + large_size;
+  check_live(1, live1 + expected, "after tagged allocation");
+  check_live(
+    2,
+    live2 + sizeclass_to_size(size_to_sizeclass(small_size)),
+    "after tagged allocation");
+
+  // Untagged allocations do not count towards a tag.
+  void* untagged = our_malloc(large_size);
+  check_live(1, live1 + expected, "after untagged allocation");
+  our_free(untagged);
+
+  // Large allocations are returned immediately, but small and medium ones
+  // once the owning allocator has processed the free.
+  our_free(large);
+  check_live(
+    1, live1 + expected - large_size, "after freeing large allocation");
+
+  for (auto p : allocs)
+    our_free(p);
+  our_free(medium);
+  our_free(other);
+  flush();
+
+  check_live(1, live1, "after free");
+  check_live(2, live2, "after free");
+}
+
+void test_threads()
+{
+  const size_t count = 100;
+  const size_t size = 128;
+  size_t live3 = live(3);
+
+  // Objects allocated with a tag by another thread are attributed to the
+  // tag after the thread has exited.
+  std::vector<void*> allocs;
+  std::thread t([&allocs]() {
+    for (size_t i = 0; i < count; i++)
+      allocs.push_back(our_snmalloc_tagged_malloc(size, 3));
+  });
+  t.join();
+
+  check_live(3, live3 + (count * size), "after thread exit");
+
+  for (auto p : allocs)
+    our_free(p);
+
+  // The exited thread's allocator is reused by the next thread to allocate
+  // with the same tag, which then processes the frees.
+  our_free(our_snmalloc_tagged_malloc(size, 3));
+  flush();
+  check_live(3, live3, "after free");
+}
+
+int main()
+{
+  setup();
+
+  test_api();
+  test_local();
+  test_threads();
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "usage.h"
+
 #include <chrono>
 #include <iomanip>
 #include <iostream>
@@ -7,15 +9,29 @@
 
 class MeasureTime : public std::stringstream
 {
+  usage::Measure usage;
+  size_t ops = 0;
+
   std::chrono::time_point<std::chrono::high_resolution_clock> start =
     std::chrono::high_resolution_clock::now();
 
 public:
+  /**
+   * Set the number of operations that are measured.  If set, the throughput,
+   * memory use and page faults per operation are also reported.
+   */
+  void operations(size_t n)
+  {
+    ops = n;
+  }
+
   ~MeasureTime()
   {
     auto finish = std::chrono::high_resolution_clock::now();
     auto diff = finish - start;
     std::cout << str() << ": " << std::setw(12) << diff.count() << " ns"
               << std::endl;
+    if (ops != 0)
+      usage.report(std::cout, ops);
   }
-};
\ No newline at end of file
+};
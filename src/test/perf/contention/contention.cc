@@ -122,10 +122,13 @@ void test_tasks(size_t num_tasks, size_t count, size_t size)
 #endif
 
   {
+    usage::Measure m;
     ParallelTest<test_tasks_f> test(num_tasks);
 
     std::cout << "Task test, " << num_tasks << " threads, " << count
               << " swaps per thread " << test.time() << "ticks" << std::endl;
+    // Each swap allocates one object and frees another.
+    m.report(std::cout, num_tasks * count * 2);
 
     for (size_t n = 0; n < swapsize; n++)
     {
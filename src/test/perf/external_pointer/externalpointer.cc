@@ -67,6 +67,7 @@ namespace test
     {
       MeasureTime m;
       m << "External pointer queries ";
+      m.operations(iterations);
       for (size_t i = 0; i < iterations; i++)
       {
         size_t rand = (size_t)r.next();
@@ -0,0 +1,120 @@
+/**
+ * Many threads free the objects of one allocator, so that they all post to
+ * its message queue while its owner drains it.  This sweeps the number of
+ * freeing threads and how many objects each frees between posts of its
+ * remote cache, and reports the throughput of the frees.  The fan_in_sharded
+ * test builds this with `USE_REMOTE_QUEUE_SHARDS`, so the two can be compared.
+ */
+
+#include "test/opt.h"
+#include "test/setup.h"
+#include "test/usage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <snmalloc.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+/**
+ * Allocate `objects` objects for each of `threads` threads from this
+ * thread, then free them all from those threads, each posting its remote
+ * cache after every `post` frees.  Returns the frees per second.
+ */
+double fan_in(size_t threads, size_t post, size_t objects, size_t size)
+{
+  auto* a = ThreadAlloc::get();
+  std::vector<std::vector<void*>> work(threads);
+  for (auto& w : work)
+    for (size_t i = 0; i < objects; i++)
+      w.push_back(a->alloc(size));
+
+  std::atomic<size_t> ready{0};
+  std::atomic<size_t> running{threads};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> ts;
+  for (size_t t = 0; t < threads; t++)
+  {
+    ts.emplace_back([&, t]() {
+      auto* b = ThreadAlloc::get();
+      ready++;
+      while (!go)
+        Aal::pause();
+
+      size_t n = 0;
+      for (auto p : work[t])
+      {
+        b->dealloc(p, size);
+        if (++n == post)
+        {
+          b->flush();
+          n = 0;
+        }
+      }
+      b->flush();
+      running--;
+    });
+  }
+
+  while (ready != threads)
+    std::this_thread::yield();
+  auto start = std::chrono::steady_clock::now();
+  go = true;
+
+  // The owner takes messages as they arrive, as a busy thread would.
+  while (running != 0)
+  {
+    a->flush();
+    std::this_thread::yield();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (auto& t : ts)
+    t.join();
+  a->flush();
+
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+              .count();
+  return static_cast<double>(threads * objects) * 1e9 /
+    static_cast<double>(std::max<int64_t>(ns, 1));
+}
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  size_t objects = opt.is<size_t>("--objects", 1 << 15);
+  size_t max_threads = opt.is<size_t>(
+    "--threads",
+    std::max<size_t>(std::thread::hardware_concurrency(), 8));
+  size_t size = opt.is<size_t>("--size", 16);
+
+  const size_t posts[] = {1, 64, 4096};
+
+  std::cout << "Message queue shards: " << REMOTE_QUEUE_SHARDS << std::endl
+            << "Objects per thread: " << objects << ", size: " << size
+            << std::endl
+            << "threads    post      frees/s" << std::endl;
+
+  usage::Measure m;
+  size_t ops = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    for (auto post : posts)
+    {
+      double rate = fan_in(threads, post, objects, size);
+      ops += threads * objects * 2;
+      std::cout << std::setw(7) << threads << std::setw(8) << post
+                << std::setw(13) << static_cast<uint64_t>(rate) << std::endl;
+    }
+
+  std::cout << "Overall, counting allocations and frees:" << std::endl;
+  m.report(std::cout, ops);
+
+  return 0;
+}
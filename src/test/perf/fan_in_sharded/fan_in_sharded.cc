@@ -0,0 +1,8 @@
+/**
+ * The fan_in benchmark, with each allocator's message queue split into
+ * shards.
+ */
+
+#define USE_REMOTE_QUEUE_SHARDS 4
+
+#include "../fan_in/fan_in.cc"
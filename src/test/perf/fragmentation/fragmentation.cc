@@ -0,0 +1,232 @@
+/**
+ * Runs phases of shifting allocation mixes and tracks how the resident set
+ * compares with the bytes actually in use.  Each cycle allocates many small
+ * objects and frees most of them, then churns large allocations around the
+ * survivors, then leaves a sparse set of survivors in freshly filled slabs.
+ * The survivors of each cycle live until the end of the next, so memory that
+ * cannot be reused accumulates if the allocator fragments.
+ *
+ * Run with a larger `--cycles` for a long soak.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <snmalloc.h>
+#include <test/opt.h>
+#include <test/setup.h>
+#include <test/usage.h>
+#include <test/xoroshiro.h>
+#include <vector>
+
+using namespace snmalloc;
+
+class Workload
+{
+  xoroshiro::p128r64 r;
+  size_t target;
+  size_t live = 0;
+  size_t ops = 0;
+  usage::Measure measure;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  /**
+   * The resident set before the workload starts, which is not counted
+   * towards fragmentation.
+   */
+  size_t baseline = usage::resident_bytes();
+
+  size_t peak_resident = 0;
+  double peak_ratio = 0;
+
+  std::vector<void*> survivors;
+  std::vector<void*> previous_survivors;
+
+public:
+  Workload(size_t target) : target(target) {}
+
+private:
+  void* alloc(size_t size)
+  {
+    void* p = ThreadAlloc::get()->alloc(size);
+    live += ThreadAlloc::get()->alloc_size(p);
+    if ((++ops % 4096) == 0)
+      sample();
+    return p;
+  }
+
+  void dealloc(void* p)
+  {
+    live -= ThreadAlloc::get()->alloc_size(p);
+    ThreadAlloc::get()->dealloc(p);
+    if ((++ops % 4096) == 0)
+      sample();
+  }
+
+  size_t random_size(size_t min, size_t max)
+  {
+    return min + static_cast<size_t>(r.next() % (max - min));
+  }
+
+  double ratio(size_t resident)
+  {
+    if (live == 0)
+      return 0;
+    return static_cast<double>(resident - std::min(resident, baseline)) /
+      static_cast<double>(live);
+  }
+
+  void sample()
+  {
+    size_t resident = usage::resident_bytes();
+    peak_resident = std::max(peak_resident, resident);
+    if (live > target / 16)
+      peak_ratio = std::max(peak_ratio, ratio(resident));
+  }
+
+  void report(size_t cycle, const char* phase)
+  {
+    sample();
+    size_t resident = usage::resident_bytes();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+    std::cout << std::setw(8) << ms << std::setw(6) << cycle << std::setw(9)
+              << phase << std::setw(8) << (resident >> 10) << std::setw(10)
+              << (default_memory_provider().memory_usage().first >> 10)
+              << std::setw(8) << (live >> 10) << std::setw(8)
+              << std::setprecision(3) << std::fixed << ratio(resident)
+              << std::endl;
+  }
+
+  /**
+   * Fill with small objects, then free nine in ten of them at random.
+   */
+  void small_phase()
+  {
+    std::vector<void*> objects;
+    size_t goal = live + target;
+    while (live < goal)
+      objects.push_back(alloc(random_size(16, 1024)));
+
+    for (auto p : objects)
+    {
+      if ((r.next() % 10) == 0)
+        survivors.push_back(p);
+      else
+        dealloc(p);
+    }
+  }
+
+  /**
+   * Churn large allocations around the survivors.
+   */
+  void large_phase()
+  {
+    std::vector<void*> objects;
+    for (size_t i = 0; i < 4 * (target / (1 << 20)); i++)
+    {
+      while (live < target)
+        objects.push_back(alloc(random_size(64 * 1024, 4 * 1024 * 1024)));
+
+      // Free about half of the large objects.
+      for (auto& p : objects)
+      {
+        if ((p != nullptr) && ((r.next() % 2) == 0))
+        {
+          dealloc(p);
+          p = nullptr;
+        }
+      }
+      objects.erase(
+        std::remove(objects.begin(), objects.end(), nullptr), objects.end());
+    }
+
+    for (auto p : objects)
+      dealloc(p);
+  }
+
+  /**
+   * Fill slabs with small objects and keep one in 64.
+   */
+  void sparse_phase()
+  {
+    std::vector<void*> objects;
+    size_t goal = live + target;
+    while (live < goal)
+      objects.push_back(alloc(random_size(64, 256)));
+
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+      if ((i % 64) == 0)
+        survivors.push_back(objects[i]);
+      else
+        dealloc(objects[i]);
+    }
+  }
+
+public:
+  void cycle(size_t c)
+  {
+    small_phase();
+    report(c, "small");
+    large_phase();
+    report(c, "large");
+    sparse_phase();
+    report(c, "sparse");
+
+    for (auto p : previous_survivors)
+      dealloc(p);
+    previous_survivors.swap(survivors);
+    survivors.clear();
+  }
+
+  void finish()
+  {
+    for (auto p : previous_survivors)
+      dealloc(p);
+    previous_survivors.clear();
+
+    // Return the cached chunks, so that the final resident set shows what
+    // the allocator could not give back.
+    default_memory_provider().purge();
+    report(0, "final");
+
+    std::cout << "Peak RSS: " << (usage::peak_resident_bytes() >> 10)
+              << " KiB, sampled peak RSS: " << (peak_resident >> 10)
+              << " KiB, final RSS: " << (usage::resident_bytes() >> 10)
+              << " KiB, peak fragmentation (RSS growth / live): " << peak_ratio
+              << std::endl;
+    measure.report(std::cout, ops);
+  }
+};
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  size_t cycles = opt.is<size_t>("--cycles", 2);
+  size_t target_mib = opt.is<size_t>("--target_mib", 16);
+
+  if (usage::resident_bytes() == 0)
+  {
+    std::cout << "Resident set size is not available on this platform"
+              << std::endl;
+    return 0;
+  }
+
+  std::cout << "Sizes in KiB; ratio is the growth in RSS over the live bytes"
+            << std::endl
+            << "    time cycle    phase     RSS committed    live   ratio"
+            << std::endl;
+
+  Workload w(target_mib << 20);
+  for (size_t c = 1; c <= cycles; c++)
+    w.cycle(c);
+  w.finish();
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include <snmalloc.h>
 #include <test/opt.h>
 #include <test/setup.h>
+#include <test/usage.h>
 #include <unordered_set>
 #include <vector>
 
@@ -16,9 +17,11 @@ class Queue
 {
   Node* head;
   Node* tail;
+  size_t ops = 0;
 
   Node* new_node(size_t size)
   {
+    ops++;
     auto result = (Node*)ThreadAlloc::get()->alloc(size);
     result->next = nullptr;
     return result;
@@ -44,9 +47,18 @@ public:
 
     Node* next = head->next;
     ThreadAlloc::get()->dealloc(head);
+    ops++;
     head = next;
     return true;
   }
+
+  /**
+   * The number of allocations and deallocations made.
+   */
+  size_t operations()
+  {
+    return ops;
+  }
 };
 
 std::atomic<uint64_t> global_epoch = 0;
@@ -141,10 +153,13 @@ int main(int argc, char** argv)
 
   for (size_t i = 0; i < 10; i++)
   {
+    usage::Measure m;
+    size_t ops = allocations.operations();
     reach_pressure(allocations);
     std::cout << "Pressure " << i << std::endl;
 
     reduce_pressure(allocations);
+    m.report(std::cout, allocations.operations() - ops);
   }
 
   // Deallocate everything
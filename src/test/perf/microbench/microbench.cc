@@ -0,0 +1,384 @@
+/**
+ * Microbenchmarks of the allocator's individual paths, measured with
+ * hardware performance counters where the platform allows, and otherwise
+ * with `Aal::tick`.
+ *
+ *   perf-microbench-1 [--json <file>] [--compare <baseline>]
+ *                     [--threshold <percent>] [--ops <n>] [--reps <n>]
+ *
+ * Results are per operation, from the fastest of several repetitions, and
+ * include the minor page faults taken.  They are printed as JSON, and
+ * written to `--json` if given.  With `--compare`, each result is compared
+ * with the same path and size in an earlier result file, and the exit
+ * status is non-zero if cycles (or ticks) or instructions grew by more than
+ * `--threshold` percent, 5 by default.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <snmalloc.h>
+#include <sstream>
+#include <string>
+#include <test/opt.h>
+#include <test/perfcounters.h>
+#include <test/setup.h>
+#include <test/usage.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+using namespace perfcounters;
+
+struct Result
+{
+  std::string path;
+  size_t size;
+  size_t ops;
+  uint64_t ticks;
+  uint64_t values[NUM_EVENTS];
+  uint64_t page_faults;
+};
+
+class Bench
+{
+  Counters counters;
+  size_t reps;
+  std::vector<Result> results;
+
+public:
+  Bench(size_t reps) : reps(reps) {}
+
+  /**
+   * Run `setup`, then measure `body`, `reps` times, and keep the fastest.
+   * Both are given the number of operations to perform.
+   */
+  template<typename Setup, typename Body>
+  void
+  measure(const char* path, size_t size, size_t ops, Setup setup, Body body)
+  {
+    Result best{path, size, ops, UINT64_MAX, {}, 0};
+    for (size_t r = 0; r < reps; r++)
+    {
+      setup(ops);
+
+      uint64_t values[NUM_EVENTS] = {};
+      uint64_t faults = usage::current().minor_faults;
+      counters.start();
+      uint64_t start = Aal::tick();
+      body(ops);
+      uint64_t ticks = Aal::tick() - start;
+      counters.stop(values);
+      faults = usage::current().minor_faults - faults;
+
+      bool better = counters.available(Cycles) ?
+        (values[Cycles] < best.values[Cycles]) || (best.ticks == UINT64_MAX) :
+        ticks < best.ticks;
+      if (better)
+      {
+        best.ticks = ticks;
+        best.page_faults = faults;
+        std::copy(std::begin(values), std::end(values), best.values);
+      }
+    }
+    results.push_back(best);
+  }
+
+  void write_json(std::ostream& out)
+  {
+    out << "{\n  \"counters\": \""
+        << (counters.any_available() ? "perf_event" : "tick")
+        << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      auto& r = results[i];
+      double ops = static_cast<double>(r.ops);
+      out << "    {\"path\": \"" << r.path << "\", \"size\": " << r.size
+          << ", \"ops\": " << r.ops << std::fixed << std::setprecision(2)
+          << ", \"ticks\": " << static_cast<double>(r.ticks) / ops
+          << ", \"page_faults\": " << std::setprecision(4)
+          << static_cast<double>(r.page_faults) / ops << std::setprecision(2);
+      for (size_t e = 0; e < NUM_EVENTS; e++)
+      {
+        if (counters.available(e))
+          out << ", \"" << event_name(e)
+              << "\": " << static_cast<double>(r.values[e]) / ops;
+      }
+      out << "}" << ((i + 1 == results.size()) ? "" : ",") << "\n";
+    }
+    out << "  ]\n}\n";
+  }
+
+  /**
+   * Compare with the results in `file`, which was written by `write_json`.
+   * Returns false if any result has regressed by more than `threshold`
+   * percent.
+   */
+  bool compare(const char* file, double threshold)
+  {
+    std::ifstream in(file);
+    if (!in)
+    {
+      std::cerr << "Cannot open " << file << std::endl;
+      return false;
+    }
+
+    // Each result is on a line of its own.
+    std::map<std::pair<std::string, size_t>, std::map<std::string, double>>
+      baseline;
+    std::string line;
+    while (std::getline(in, line))
+    {
+      auto p = line.find("\"path\": \"");
+      if (p == std::string::npos)
+        continue;
+      p += 9;
+      std::string path = line.substr(p, line.find('"', p) - p);
+
+      std::map<std::string, double> metrics;
+      size_t size = 0;
+      size_t pos = line.find(',', p);
+      while (pos != std::string::npos)
+      {
+        auto name_start = line.find('"', pos);
+        if (name_start == std::string::npos)
+          break;
+        auto name_end = line.find('"', name_start + 1);
+        std::string name =
+          line.substr(name_start + 1, name_end - name_start - 1);
+        double value = std::stod(line.substr(name_end + 2));
+        if (name == "size")
+          size = static_cast<size_t>(value);
+        else
+          metrics[name] = value;
+        pos = line.find(',', name_end);
+      }
+      baseline[{path, size}] = metrics;
+    }
+
+    bool ok = true;
+    std::cout << "Change from " << file << " (threshold " << threshold
+              << "%)" << std::endl;
+    for (auto& r : results)
+    {
+      auto it = baseline.find({r.path, r.size});
+      if (it == baseline.end())
+        continue;
+
+      double ops = static_cast<double>(r.ops);
+      auto check = [&](const char* name, double now) {
+        auto m = it->second.find(name);
+        if ((m == it->second.end()) || (m->second == 0))
+          return;
+        double change = 100 * (now - m->second) / m->second;
+        bool regressed = change > threshold;
+        std::cout << "  " << std::left << std::setw(20) << r.path
+                  << std::right << std::setw(8) << r.size << std::setw(16)
+                  << name << std::setw(10) << std::fixed
+                  << std::setprecision(1) << change << "%"
+                  << (regressed ? "  REGRESSED" : "") << std::endl;
+        ok = ok && !regressed;
+      };
+
+      if (counters.available(Cycles))
+        check("cycles", static_cast<double>(r.values[Cycles]) / ops);
+      else
+        check("ticks", static_cast<double>(r.ticks) / ops);
+      if (counters.available(Instructions))
+        check(
+          "instructions", static_cast<double>(r.values[Instructions]) / ops);
+    }
+    return ok;
+  }
+};
+
+std::vector<void*> objects;
+
+void alloc_n(size_t size, size_t n)
+{
+  auto* a = ThreadAlloc::get();
+  for (size_t i = 0; i < n; i++)
+    objects.push_back(a->alloc(size));
+}
+
+void free_all(size_t size)
+{
+  auto* a = ThreadAlloc::get();
+  for (auto p : objects)
+    a->dealloc(p, size);
+  objects.clear();
+}
+
+/**
+ * Have another thread allocate `n` objects.  Its allocator is released
+ * when it exits, so freeing them here is remote.
+ */
+void alloc_n_elsewhere(size_t size, size_t n)
+{
+  std::thread t([size, n]() { alloc_n(size, n); });
+  t.join();
+}
+
+void small_paths(Bench& b, size_t size, size_t ops)
+{
+  auto* a = ThreadAlloc::get();
+
+  // Objects come from the fast free list, which is refilled from the free
+  // lists of partially used slabs.
+  b.measure(
+    "fast_free_list",
+    size,
+    ops,
+    [size](size_t n) {
+      alloc_n(size, n);
+      free_all(size);
+    },
+    [a, size](size_t n) {
+      for (size_t i = 0; i < n; i++)
+        objects.push_back(a->alloc(size));
+    });
+  free_all(size);
+
+  // Each allocation takes a free list from a slab, as only one object in
+  // each slab is free.
+  size_t per_slab = SLAB_SIZE / bits::max<size_t>(size, 1);
+  b.measure(
+    "next_free_list",
+    size,
+    ops / 64,
+    [size, per_slab](size_t n) {
+      free_all(size);
+      alloc_n(size, n * per_slab);
+      std::vector<void*> keep;
+      auto* a = ThreadAlloc::get();
+      for (size_t i = 0; i < objects.size(); i++)
+      {
+        if ((i % per_slab) == 0)
+          a->dealloc(objects[i], size);
+        else
+          keep.push_back(objects[i]);
+      }
+      objects.swap(keep);
+    },
+    [a, size](size_t n) {
+      std::vector<void*> got;
+      got.reserve(n);
+      for (size_t i = 0; i < n; i++)
+        got.push_back(a->alloc(size));
+      objects.insert(objects.end(), got.begin(), got.end());
+    });
+  free_all(size);
+
+  // Every slab is used for the first time, so each allocation carves a new
+  // free list, and regularly needs a new slab.
+  b.measure(
+    "new_slab",
+    size,
+    ops,
+    [](size_t) {},
+    [a, size](size_t n) {
+      for (size_t i = 0; i < n; i++)
+        objects.push_back(a->alloc(size));
+    });
+  free_all(size);
+
+  b.measure(
+    "local_free",
+    size,
+    ops,
+    [size](size_t n) { alloc_n(size, n); },
+    [size](size_t) { free_all(size); });
+
+  b.measure(
+    "remote_free",
+    size,
+    ops,
+    [size](size_t n) { alloc_n_elsewhere(size, n); },
+    [size](size_t) { free_all(size); });
+  a->flush();
+
+  // This thread owns the objects, and another thread has freed them, so
+  // they are waiting in this thread's message queue.
+  b.measure(
+    "queue_drain",
+    size,
+    ops,
+    [size](size_t n) {
+      alloc_n(size, n);
+      std::thread t([size]() {
+        free_all(size);
+        ThreadAlloc::get()->flush();
+      });
+      t.join();
+    },
+    [a](size_t n) {
+      // The most recent message stays in the queue until another arrives.
+      const auto& received = a->counters().remote_received;
+      size_t target = received + n - 1;
+      for (size_t i = 0; (received < target) && (i < n); i++)
+        a->flush();
+    });
+}
+
+void bigger_paths(Bench& b, const char* path, size_t size, size_t ops)
+{
+  auto* a = ThreadAlloc::get();
+  std::string alloc_path = std::string(path) + "_alloc";
+  std::string free_path = std::string(path) + "_free";
+
+  b.measure(
+    alloc_path.c_str(),
+    size,
+    ops,
+    [size](size_t n) {
+      alloc_n(size, n);
+      free_all(size);
+    },
+    [a, size](size_t n) {
+      for (size_t i = 0; i < n; i++)
+        objects.push_back(a->alloc(size));
+    });
+  free_all(size);
+
+  b.measure(
+    free_path.c_str(),
+    size,
+    ops,
+    [size](size_t n) { alloc_n(size, n); },
+    [size](size_t) { free_all(size); });
+}
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  size_t ops = opt.is<size_t>("--ops", 1 << 14);
+  size_t reps = opt.is<size_t>("--reps", 5);
+  const char* json = opt.is("--json", static_cast<const char*>(nullptr));
+  const char* baseline =
+    opt.is("--compare", static_cast<const char*>(nullptr));
+  double threshold = static_cast<double>(opt.is<size_t>("--threshold", 5));
+
+  objects.reserve(ops * 64);
+
+  Bench b(reps);
+  for (size_t size : {16, 64, 256, 1024, 4096})
+    small_paths(b, size, ops);
+  bigger_paths(b, "medium", SLAB_SIZE * 2, ops / 64);
+  bigger_paths(b, "large", SUPERSLAB_SIZE * 2, 16);
+
+  b.write_json(std::cout);
+  if (json != nullptr)
+  {
+    std::ofstream out(json);
+    b.write_json(out);
+  }
+
+  if ((baseline != nullptr) && !b.compare(baseline, threshold))
+    return 1;
+
+  return 0;
+}
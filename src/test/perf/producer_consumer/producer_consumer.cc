@@ -0,0 +1,225 @@
+/**
+ * Pipelines in which one set of threads allocates and another frees, so
+ * that every deallocation is remote.  This sweeps the ratio of producers to
+ * consumers, the number of objects handed over at a time, and the object
+ * size, and reports the throughput, the latency of the consumers' frees,
+ * and the bytes waiting to be returned to their owners.
+ */
+
+#include "test/opt.h"
+#include "test/setup.h"
+#include "test/usage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <snmalloc.h>
+#include <thread>
+#include <vector>
+
+using namespace snmalloc;
+
+/**
+ * Single-producer, single-consumer ring of objects.
+ */
+struct alignas(CACHELINE_SIZE) Ring
+{
+  static constexpr size_t CAPACITY = 1024;
+
+  alignas(CACHELINE_SIZE) std::atomic<size_t> head{0};
+  alignas(CACHELINE_SIZE) std::atomic<size_t> tail{0};
+  void* slots[CAPACITY];
+};
+
+struct Config
+{
+  size_t producers;
+  size_t consumers;
+  size_t batch;
+  size_t size;
+};
+
+class Pipeline
+{
+  Config config;
+  size_t objects;
+  std::vector<Ring> rings;
+  std::atomic<size_t> producers_running;
+  std::vector<std::vector<uint64_t>> latencies;
+
+  Ring& ring(size_t producer, size_t consumer)
+  {
+    return rings[(producer * config.consumers) + consumer];
+  }
+
+  void produce(size_t id)
+  {
+    auto* a = ThreadAlloc::get();
+    for (size_t sent = 0, batch = 0; sent < objects; batch++)
+    {
+      auto& r = ring(id, batch % config.consumers);
+      size_t n = std::min(config.batch, objects - sent);
+      size_t tail = r.tail.load(std::memory_order_relaxed);
+      while (tail + n - r.head.load(std::memory_order_acquire) > Ring::CAPACITY)
+        Aal::pause();
+
+      for (size_t i = 0; i < n; i++)
+      {
+        void* p = a->alloc(config.size);
+        *static_cast<size_t*>(p) = i;
+        r.slots[(tail + i) % Ring::CAPACITY] = p;
+      }
+      r.tail.store(tail + n, std::memory_order_release);
+      sent += n;
+    }
+    producers_running--;
+  }
+
+  void consume(size_t id)
+  {
+    auto* a = ThreadAlloc::get();
+    auto& lat = latencies[id];
+
+    bool done;
+    do
+    {
+      done = producers_running.load() == 0;
+      bool idle = true;
+      for (size_t p = 0; p < config.producers; p++)
+      {
+        auto& r = ring(p, id);
+        size_t head = r.head.load(std::memory_order_relaxed);
+        size_t tail = r.tail.load(std::memory_order_acquire);
+        for (; head != tail; head++)
+        {
+          void* o = r.slots[head % Ring::CAPACITY];
+          uint64_t start = Aal::tick();
+          a->dealloc(o, config.size);
+          lat.push_back(Aal::tick() - start);
+          idle = false;
+        }
+        r.head.store(head, std::memory_order_release);
+      }
+      if (idle)
+        Aal::pause();
+    } while (!done);
+  }
+
+public:
+  Pipeline(Config config, size_t objects)
+  : config(config),
+    objects(objects),
+    rings(config.producers * config.consumers),
+    producers_running(config.producers),
+    latencies(config.consumers)
+  {
+    for (auto& l : latencies)
+      l.reserve((objects * config.producers) / config.consumers + objects);
+  }
+
+  void run()
+  {
+    AllocCounterTotals before;
+    current_alloc_pool()->aggregate_counters(before);
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < config.consumers; i++)
+      threads.emplace_back([this, i]() { consume(i); });
+    for (size_t i = 0; i < config.producers; i++)
+      threads.emplace_back([this, i]() { produce(i); });
+
+    // Sample the bytes waiting in remote caches and message queues while
+    // the pipeline runs.  Earlier runs leave objects in the queues of
+    // allocators whose threads have exited, so report the growth.
+    int64_t base_cached = 0;
+    int64_t base_queued = 0;
+    current_alloc_pool()->aggregate_remote_bytes(base_cached, base_queued);
+    int64_t max_cached = base_cached;
+    int64_t max_queued = base_queued;
+    std::thread monitor([&]() {
+      while (running.load())
+      {
+        int64_t cached = 0;
+        int64_t queued = 0;
+        current_alloc_pool()->aggregate_remote_bytes(cached, queued);
+        max_cached = std::max(max_cached, cached);
+        max_queued = std::max(max_queued, queued);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+      }
+    });
+
+    for (auto& t : threads)
+      t.join();
+    auto end = std::chrono::steady_clock::now();
+    running = false;
+    monitor.join();
+
+    AllocCounterTotals after;
+    current_alloc_pool()->aggregate_counters(after);
+
+    std::vector<uint64_t> lat;
+    for (auto& l : latencies)
+      lat.insert(lat.end(), l.begin(), l.end());
+    std::sort(lat.begin(), lat.end());
+    auto percentile = [&lat](double p) {
+      return lat.empty() ?
+        uint64_t(0) :
+        lat[static_cast<size_t>(p * static_cast<double>(lat.size() - 1))];
+    };
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                .count();
+    double total = static_cast<double>(objects * config.producers);
+
+    std::cout << std::setw(3) << config.producers << ":" << std::left
+              << std::setw(3) << config.consumers << std::right
+              << std::setw(7) << config.batch << std::setw(7) << config.size
+              << std::setw(12)
+              << static_cast<uint64_t>(
+                   total * 1e9 / static_cast<double>(std::max<int64_t>(ns, 1)))
+              << std::setw(8) << percentile(0.5) << std::setw(8)
+              << percentile(0.99) << std::setw(10) << percentile(1.0)
+              << std::setw(10) << (after.remote_posts - before.remote_posts)
+              << std::setw(12) << (max_queued - base_queued) << std::setw(12)
+              << (max_cached - base_cached)
+              << std::endl;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  size_t objects = opt.is<size_t>("--objects", 1 << 15);
+
+  const std::pair<size_t, size_t> ratios[] = {{1, 1}, {1, 3}, {3, 1}, {2, 2}};
+  const size_t batches[] = {1, 64};
+  const size_t sizes[] = {16, 256, 4096};
+
+  std::cout << "Objects per producer: " << objects << std::endl
+            << "Free latency in ticks; queued and cached are the peak bytes "
+               "awaiting return"
+            << std::endl
+            << "P:C      batch   size    objects/s     p50     p99       max"
+               "     posts      queued      cached"
+            << std::endl;
+
+  usage::Measure m;
+  size_t ops = 0;
+  for (auto [producers, consumers] : ratios)
+    for (auto batch : batches)
+      for (auto size : sizes)
+      {
+        Pipeline({producers, consumers, batch, size}, objects).run();
+        ops += objects * producers * 2;
+      }
+
+  std::cout << "Overall, counting allocations and frees:" << std::endl;
+  m.report(std::cout, ops);
+
+  return 0;
+}
@@ -0,0 +1,388 @@
+/**
+ * Replays an allocation trace recorded by `override/trace.h`, with the
+ * same threads and the same order of calls, and reports the throughput, the
+ * latency of each call and the peak RSS.
+ *
+ *   perf-replay-1 --trace <file> [--repeat <n>]
+ *
+ * Without `--trace`, a trace of a synthetic workload is recorded and then
+ * replayed.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <test/opt.h>
+#include <test/setup.h>
+#include <test/usage.h>
+#include <test/xoroshiro.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define SNMALLOC_NAME_MANGLE(a) our_##a
+#include "../../../override/malloc.cc"
+
+using namespace snmalloc;
+
+#ifdef SNMALLOC_TRACE
+#  include <stdio.h>
+#  include <unistd.h>
+
+constexpr size_t NO_OBJECT = SIZE_MAX;
+
+/**
+ * A call to replay.  Objects are numbered in the order they were allocated.
+ */
+struct Op
+{
+  TraceOp op;
+  uint8_t lg_align;
+  size_t size;
+  size_t object;
+  size_t old_object;
+};
+
+struct Trace
+{
+  std::vector<std::vector<Op>> threads;
+  size_t objects = 0;
+  size_t ops = 0;
+  size_t skipped = 0;
+};
+
+bool load(const char* path, Trace& trace)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    std::cerr << "Cannot open " << path << std::endl;
+    return false;
+  }
+
+  TraceHeader header;
+  if (
+    (fread(&header, sizeof(header), 1, f) != 1) ||
+    (memcmp(header.magic, TraceHeader::MAGIC, sizeof(header.magic)) != 0) ||
+    (header.version != TraceHeader::VERSION) ||
+    (header.record_size != sizeof(TraceRecord)))
+  {
+    std::cerr << path << " is not a trace" << std::endl;
+    fclose(f);
+    return false;
+  }
+
+  std::vector<TraceRecord> records;
+  TraceRecord r;
+  while (fread(&r, sizeof(r), 1, f) == 1)
+    records.push_back(r);
+  fclose(f);
+
+  std::stable_sort(
+    records.begin(), records.end(), [](const auto& a, const auto& b) {
+      return a.tick < b.tick;
+    });
+
+  // Rename addresses to objects, and threads to dense indices.
+  std::unordered_map<uint64_t, size_t> live;
+  std::unordered_map<uint32_t, size_t> threads;
+  auto take = [&live](uint64_t address) {
+    auto it = live.find(address);
+    if (it == live.end())
+      return NO_OBJECT;
+    size_t object = it->second;
+    live.erase(it);
+    return object;
+  };
+
+  for (auto& rec : records)
+  {
+    Op op{rec.op, rec.lg_align, static_cast<size_t>(rec.size), NO_OBJECT,
+          NO_OBJECT};
+
+    if (rec.op == TraceOp::Free)
+    {
+      op.object = take(rec.address);
+      if (op.object == NO_OBJECT)
+      {
+        // Allocated before tracing started.
+        trace.skipped++;
+        continue;
+      }
+    }
+    else
+    {
+      if (rec.op == TraceOp::Realloc)
+      {
+        op.old_object = take(rec.old_address);
+        if (op.old_object == NO_OBJECT)
+          op.op = TraceOp::Malloc;
+      }
+      op.object = trace.objects++;
+      live[rec.address] = op.object;
+    }
+
+    auto t = threads.emplace(rec.thread, threads.size()).first->second;
+    if (t == trace.threads.size())
+      trace.threads.emplace_back();
+    trace.threads[t].push_back(op);
+    trace.ops++;
+  }
+
+  return true;
+}
+
+class Replay
+{
+  const Trace& trace;
+  std::unique_ptr<std::atomic<void*>[]> objects;
+  std::vector<std::vector<uint64_t>> latencies;
+  std::atomic<size_t> ready{0};
+  std::atomic<bool> go{false};
+
+  /**
+   * Wait for another thread to allocate `object`, and take it.
+   */
+  void* take(size_t object)
+  {
+    void* p;
+    while ((p = objects[object].load(std::memory_order_acquire)) == nullptr)
+      Aal::pause();
+    objects[object].store(nullptr, std::memory_order_relaxed);
+    return p;
+  }
+
+  void run(size_t t)
+  {
+    auto& lat = latencies[t];
+    lat.reserve(trace.threads[t].size());
+
+    ready++;
+    while (!go.load(std::memory_order_acquire))
+      Aal::pause();
+
+    for (auto& op : trace.threads[t])
+    {
+      void* old = nullptr;
+      if (op.op == TraceOp::Free)
+        old = take(op.object);
+      else if (op.old_object != NO_OBJECT)
+        old = take(op.old_object);
+
+      void* p = nullptr;
+      uint64_t start = Aal::tick();
+      switch (op.op)
+      {
+        case TraceOp::Malloc:
+          p = our_malloc(op.size);
+          break;
+        case TraceOp::Calloc:
+          p = our_calloc(1, op.size);
+          break;
+        case TraceOp::Realloc:
+          p = our_realloc(old, op.size);
+          break;
+        case TraceOp::AlignedAlloc:
+          p = our_memalign(bits::one_at_bit(op.lg_align), op.size);
+          break;
+        case TraceOp::Free:
+          our_free(old);
+          break;
+      }
+      lat.push_back(Aal::tick() - start);
+
+      if (op.op != TraceOp::Free)
+      {
+        // Zero-sized allocations may return null, but the object must still
+        // be marked as allocated for the thread that frees it.
+        objects[op.object].store(
+          (p == nullptr) ? reinterpret_cast<void*>(1) : p,
+          std::memory_order_release);
+      }
+    }
+  }
+
+public:
+  Replay(const Trace& trace)
+  : trace(trace),
+    objects(new std::atomic<void*>[trace.objects]()),
+    latencies(trace.threads.size())
+  {}
+
+  /**
+   * Replay the trace, and return the time taken in nanoseconds.
+   */
+  uint64_t run()
+  {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < trace.threads.size(); t++)
+      threads.emplace_back([this, t]() { run(t); });
+
+    while (ready.load() != threads.size())
+      std::this_thread::yield();
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : threads)
+      t.join();
+    auto end = std::chrono::steady_clock::now();
+
+    // Free whatever was still live at the end of the trace.
+    for (size_t i = 0; i < trace.objects; i++)
+    {
+      void* p = objects[i].load(std::memory_order_relaxed);
+      if ((p != nullptr) && (p != reinterpret_cast<void*>(1)))
+        our_free(p);
+    }
+
+    return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+        .count());
+  }
+
+  std::vector<uint64_t> all_latencies()
+  {
+    std::vector<uint64_t> result;
+    for (auto& l : latencies)
+      result.insert(result.end(), l.begin(), l.end());
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+};
+
+void replay(const Trace& trace, size_t repeat)
+{
+  std::cout << "Trace: " << trace.ops << " calls on " << trace.threads.size()
+            << " threads, " << trace.objects << " objects, " << trace.skipped
+            << " frees of untraced objects skipped" << std::endl;
+
+  for (size_t i = 0; i < repeat; i++)
+  {
+    usage::Measure m;
+    Replay r(trace);
+    uint64_t ns = r.run();
+    auto lat = r.all_latencies();
+
+    auto percentile = [&lat](double p) {
+      if (lat.empty())
+        return uint64_t(0);
+      return lat[static_cast<size_t>(p * static_cast<double>(lat.size() - 1))];
+    };
+
+    std::cout << "Replay " << i << ": " << (ns / 1000000) << " ms, "
+              << static_cast<uint64_t>(
+                   static_cast<double>(trace.ops) * 1e9 /
+                   static_cast<double>(bits::max<uint64_t>(ns, 1)))
+              << " calls/s"
+              << std::endl
+              << "  latency (ticks): p50 " << percentile(0.5) << ", p90 "
+              << percentile(0.9) << ", p99 " << percentile(0.99)
+              << ", p99.9 " << percentile(0.999) << ", max "
+              << percentile(1.0) << std::endl;
+    m.report(std::cout, trace.ops);
+  }
+}
+
+/**
+ * A mix of calls from several threads, some of which free each other's
+ * objects.
+ */
+void synthetic_workload(size_t threads, size_t count)
+{
+  std::vector<std::atomic<void*>> shared(1024);
+  for (auto& s : shared)
+    s.store(nullptr);
+
+  auto work = [&shared, count](size_t id) {
+    xoroshiro::p128r32 r(id + 1);
+    std::vector<void*> own(256, nullptr);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      size_t size = 16 + (r.next() % (1 << (4 + (r.next() % 10))));
+      void*& slot = own[r.next() % own.size()];
+      switch (r.next() % 8)
+      {
+        case 0:
+          our_free(slot);
+          slot = our_calloc(1, size);
+          break;
+        case 1:
+          slot = our_realloc(slot, size);
+          break;
+        case 2:
+          our_free(slot);
+          slot = our_memalign(64, size);
+          break;
+        case 3:
+          our_free(
+            shared[r.next() % shared.size()].exchange(our_malloc(size)));
+          break;
+        default:
+          our_free(slot);
+          slot = our_malloc(size);
+          break;
+      }
+    }
+
+    for (auto p : own)
+      our_free(p);
+  };
+
+  std::vector<std::thread> ts;
+  for (size_t i = 0; i < threads; i++)
+    ts.emplace_back(work, i);
+  for (auto& t : ts)
+    t.join();
+
+  for (auto& s : shared)
+    our_free(s.load());
+}
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  const char* path = opt.is("--trace", static_cast<const char*>(nullptr));
+  size_t repeat = opt.is<size_t>("--repeat", 1);
+
+  char tmp[] = "/tmp/snmalloc_trace_XXXXXX";
+  if (path == nullptr)
+  {
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+      abort();
+    close(fd);
+    path = tmp;
+
+    if (our_snmalloc_trace_start(path) != 0)
+      abort();
+    synthetic_workload(
+      opt.is<size_t>("--threads", 4), opt.is<size_t>("--count", 20000));
+    our_snmalloc_trace_stop();
+  }
+
+  Trace trace;
+  if (!load(path, trace))
+    return 1;
+
+  if (path == tmp)
+  {
+    unlink(tmp);
+    if ((trace.ops == 0) || (trace.skipped != 0))
+    {
+      std::cerr << "Synthetic trace is incomplete" << std::endl;
+      abort();
+    }
+  }
+
+  replay(trace, repeat);
+  return 0;
+}
+#else
+int main()
+{
+  return 0;
+}
+#endif
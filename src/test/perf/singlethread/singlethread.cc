@@ -16,11 +16,13 @@ void test_alloc_dealloc(size_t count, size_t size, bool write)
       << size << ", ZeroMem: " << (zero_mem == YesZero) << ", Write: " << write;
 
     std::unordered_set<void*> set;
+    size_t ops = 0;
 
     // alloc 1.5x objects
     for (size_t i = 0; i < ((count * 3) / 2); i++)
     {
       void* p = alloc->alloc<zero_mem>(size);
+      ops++;
       SNMALLOC_CHECK(set.find(p) == set.end());
 
       if (write)
@@ -35,6 +37,7 @@ void test_alloc_dealloc(size_t count, size_t size, bool write)
       auto it = set.begin();
       void* p = *it;
       alloc->dealloc(p, size);
+      ops++;
       set.erase(it);
       SNMALLOC_CHECK(set.find(p) == set.end());
     }
@@ -43,6 +46,7 @@ void test_alloc_dealloc(size_t count, size_t size, bool write)
     for (size_t i = 0; i < count; i++)
     {
       void* p = alloc->alloc<zero_mem>(size);
+      ops++;
       SNMALLOC_CHECK(set.find(p) == set.end());
 
       if (write)
@@ -56,8 +60,11 @@ void test_alloc_dealloc(size_t count, size_t size, bool write)
     {
       auto it = set.begin();
       alloc->dealloc(*it, size);
+      ops++;
       set.erase(it);
     }
+
+    m.operations(ops);
   }
 
   current_alloc_pool()->debug_check_empty();
@@ -0,0 +1,200 @@
+/**
+ * Measures the cost of short-lived threads to the allocator: the first
+ * allocation of a thread, which acquires an allocator from the pool (and
+ * constructs one, with its message queue, if the pool is empty), and the
+ * release of the allocator back to the pool when the thread finishes.
+ *
+ * This sweeps the number of allocations each thread makes in its lifetime
+ * and the number of threads running at once.  First allocations are
+ * reported separately for threads that were given a new allocator, and
+ * threads that re-acquired a pooled one.  Latencies are in ticks.
+ *
+ *   perf-thread_churn-1 [--threads <n>]
+ *
+ * `--threads` is the number of threads started for each configuration.
+ */
+
+#include "test/opt.h"
+#include "test/setup.h"
+#include "test/usage.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <snmalloc.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace snmalloc;
+
+/**
+ * Gives access to the release of the calling thread's allocator, which is
+ * otherwise only run as the thread exits, so that it can be timed.
+ */
+struct Teardown : public ThreadAlloc
+{
+  static void release()
+  {
+    inner_release();
+  }
+};
+
+struct Sample
+{
+  uint64_t first_alloc;
+  uint64_t teardown;
+  bool new_allocator;
+};
+
+/**
+ * Every allocator that has been handed to a thread so far.
+ */
+std::mutex seen_lock;
+std::unordered_set<void*> seen;
+
+/**
+ * Wait until `n` threads have arrived.
+ */
+void arrive(std::atomic<size_t>& count, size_t n)
+{
+  count++;
+  while (count.load() < n)
+    std::this_thread::yield();
+}
+
+/**
+ * Threads in a round start together, and all hold an allocator at once, so
+ * that a round of `n` threads needs `n` allocators.
+ */
+Sample run_thread(
+  size_t lifetime,
+  std::atomic<size_t>& started,
+  std::atomic<size_t>& acquired,
+  size_t n)
+{
+  Sample s;
+
+  arrive(started, n);
+  uint64_t start = Aal::tick();
+  void* p = ThreadAlloc::get()->alloc(16);
+  s.first_alloc = Aal::tick() - start;
+
+  {
+    std::lock_guard<std::mutex> g(seen_lock);
+    s.new_allocator = seen.insert(ThreadAlloc::get_noncachable()).second;
+  }
+  arrive(acquired, n);
+
+  auto* a = ThreadAlloc::get();
+  for (size_t i = 0; i < lifetime; i++)
+    a->dealloc(a->alloc(16 + ((i * 48) % 1024)));
+  a->dealloc(p);
+
+  start = Aal::tick();
+  Teardown::release();
+  s.teardown = Aal::tick() - start;
+
+  return s;
+}
+
+class Percentiles
+{
+  std::vector<uint64_t> values;
+
+public:
+  void add(uint64_t v)
+  {
+    values.push_back(v);
+  }
+
+  void print(std::ostream& out)
+  {
+    if (values.empty())
+    {
+      out << std::setw(8) << "-" << std::setw(8) << "-" << std::setw(10)
+          << "-";
+      return;
+    }
+
+    std::sort(values.begin(), values.end());
+    auto at = [this](double p) {
+      return values[static_cast<size_t>(
+        p * static_cast<double>(values.size() - 1))];
+    };
+    out << std::setw(8) << at(0.5) << std::setw(8) << at(0.99)
+        << std::setw(10) << values.back();
+  }
+};
+
+void churn(size_t lifetime, size_t concurrency, size_t threads)
+{
+  Percentiles new_first;
+  Percentiles pooled_first;
+  Percentiles teardown;
+  std::vector<Sample> samples(concurrency);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t started = 0; started < threads; started += concurrency)
+  {
+    size_t n = std::min(concurrency, threads - started);
+    std::atomic<size_t> round_started{0};
+    std::atomic<size_t> round_acquired{0};
+    std::vector<std::thread> running;
+    for (size_t i = 0; i < n; i++)
+      running.emplace_back([&, i, n]() {
+        samples[i] = run_thread(lifetime, round_started, round_acquired, n);
+      });
+    for (auto& t : running)
+      t.join();
+
+    for (size_t i = 0; i < n; i++)
+    {
+      (samples[i].new_allocator ? new_first : pooled_first)
+        .add(samples[i].first_alloc);
+      teardown.add(samples[i].teardown);
+    }
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+
+  std::cout << std::setw(8) << lifetime << std::setw(6) << concurrency
+            << std::setw(12)
+            << static_cast<uint64_t>(
+                 static_cast<double>(threads) * 1e9 /
+                 static_cast<double>(std::max<int64_t>(ns, 1)));
+  new_first.print(std::cout);
+  pooled_first.print(std::cout);
+  teardown.print(std::cout);
+  std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  setup();
+
+  opt::Opt opt(argc, argv);
+  size_t threads = opt.is<size_t>("--threads", 256);
+
+  std::cout << "First allocation and teardown in ticks, as p50 p99 max"
+            << std::endl
+            << "                          first (new alloc)     first (pooled)"
+               "            teardown"
+            << std::endl
+            << "lifetime  conc   threads/s     p50     p99       max     p50"
+               "     p99       max     p50     p99       max"
+            << std::endl;
+
+  usage::Measure m;
+  for (size_t lifetime : {0, 64, 4096})
+    for (size_t concurrency : {1, 4, 16})
+      churn(lifetime, concurrency, threads);
+
+  std::cout << "Overall, counting threads:" << std::endl;
+  m.report(std::cout, threads * 9);
+  std::cout << "Allocators created: " << seen.size() << std::endl;
+
+  return 0;
+}
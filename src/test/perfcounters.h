@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <string.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace perfcounters
+{
+  enum Event
+  {
+    Cycles,
+    Instructions,
+    BranchMisses,
+    L1DMisses,
+    LLCMisses,
+    DTLBMisses,
+    NUM_EVENTS
+  };
+
+  inline const char* event_name(size_t e)
+  {
+    static const char* names[NUM_EVENTS] = {"cycles",
+                                            "instructions",
+                                            "branch_misses",
+                                            "l1d_misses",
+                                            "llc_misses",
+                                            "dtlb_misses"};
+    return names[e];
+  }
+
+  /**
+   * Hardware performance counters for the calling thread, using
+   * `perf_event_open` on Linux.  Counters that cannot be opened, because
+   * the platform or the kernel's `perf_event_paranoid` setting does not
+   * allow them, are reported as unavailable.
+   */
+  class Counters
+  {
+    int fds[NUM_EVENTS];
+
+#if defined(__linux__)
+    static int open_event(uint32_t type, uint64_t config)
+    {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static constexpr uint64_t cache_miss(uint64_t cache)
+    {
+      return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+  public:
+    Counters()
+    {
+      for (auto& fd : fds)
+        fd = -1;
+
+#if defined(__linux__)
+      fds[Cycles] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      fds[Instructions] =
+        open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      fds[BranchMisses] =
+        open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+      fds[L1DMisses] =
+        open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+      fds[LLCMisses] =
+        open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+      fds[DTLBMisses] =
+        open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+#endif
+    }
+
+    ~Counters()
+    {
+#if defined(__linux__)
+      for (auto fd : fds)
+      {
+        if (fd >= 0)
+          close(fd);
+      }
+#endif
+    }
+
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+
+    bool available(size_t e) const
+    {
+      return fds[e] >= 0;
+    }
+
+    /**
+     * Returns true if any counter could be opened.
+     */
+    bool any_available() const
+    {
+      for (size_t e = 0; e < NUM_EVENTS; e++)
+      {
+        if (available(e))
+          return true;
+      }
+      return false;
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+      for (auto fd : fds)
+      {
+        if (fd >= 0)
+        {
+          ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+      }
+#endif
+    }
+
+    /**
+     * Stop counting, and store the counts since `start` in `values`.
+     * Unavailable counters are left unchanged.
+     */
+    void stop(uint64_t (&values)[NUM_EVENTS])
+    {
+#if defined(__linux__)
+      for (auto fd : fds)
+      {
+        if (fd >= 0)
+          ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+      for (size_t e = 0; e < NUM_EVENTS; e++)
+      {
+        uint64_t v;
+        if ((fds[e] >= 0) && (read(fds[e], &v, sizeof(v)) == sizeof(v)))
+          values[e] = v;
+      }
+#else
+      (void)values;
+#endif
+    }
+  };
+} // namespace perfcounters
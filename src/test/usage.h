@@ -10,14 +10,187 @@
 #  include <psapi.h>
 #endif
 
+#if defined(__linux__) || defined(__APPLE__)
+#  include <stdio.h>
+#  include <sys/resource.h>
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 
 namespace usage
 {
-  void print_memory()
+  /**
+   * Bytes of the process that are resident, or 0 if this is not known on
+   * this platform.
+   */
+  inline size_t resident_bytes()
   {
-#if defined(_WIN32)
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr)
+      return 0;
+    size_t size = 0;
+    size_t resident = 0;
+    int n = fscanf(f, "%zu %zu", &size, &resident);
+    fclose(f);
+    if (n != 2)
+      return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    if (!GetProcessMemoryInfo(
+          GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc)))
+      return 0;
+    return pmc.WorkingSetSize;
+#else
+    return 0;
+#endif
+  }
+
+  /**
+   * The largest resident set of the process so far, or 0 if this is not
+   * known on this platform.
+   */
+  inline size_t peak_resident_bytes()
+  {
+#if defined(__linux__) || defined(__APPLE__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+      return 0;
+#  ifdef __APPLE__
+    return static_cast<size_t>(ru.ru_maxrss);
+#  else
+    return static_cast<size_t>(ru.ru_maxrss) * 1024;
+#  endif
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    if (!GetProcessMemoryInfo(
+          GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc)))
+      return 0;
+    return pmc.PeakWorkingSetSize;
+#else
+    return 0;
+#endif
+  }
+
+  /**
+   * Memory use of the process.  Fields that are not known on this platform
+   * are 0.
+   */
+  struct Usage
+  {
+    size_t resident = 0;
+    size_t peak_resident = 0;
+
+    /**
+     * From `/proc/self/smaps_rollup`: the proportional set size, and the
+     * resident anonymous and swapped out bytes.
+     */
+    size_t proportional = 0;
+    size_t anonymous = 0;
+    size_t swap = 0;
+
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+  };
+
+  inline Usage current()
+  {
+    Usage u;
+    u.resident = resident_bytes();
+    // The peak can lag behind the current resident set, as they are
+    // sampled differently.
+    u.peak_resident = std::max(peak_resident_bytes(), u.resident);
+
+#if defined(__linux__) || defined(__APPLE__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+      u.minor_faults = static_cast<uint64_t>(ru.ru_minflt);
+      u.major_faults = static_cast<uint64_t>(ru.ru_majflt);
+    }
+#endif
+
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (f != nullptr)
+    {
+      char line[256];
+      while (fgets(line, sizeof(line), f) != nullptr)
+      {
+        size_t kib;
+        if (sscanf(line, "Pss: %zu kB", &kib) == 1)
+          u.proportional = kib * 1024;
+        else if (sscanf(line, "Anonymous: %zu kB", &kib) == 1)
+          u.anonymous = kib * 1024;
+        else if (sscanf(line, "Swap: %zu kB", &kib) == 1)
+          u.swap = kib * 1024;
+      }
+      fclose(f);
+    }
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    if (GetProcessMemoryInfo(
+          GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc)))
+      u.minor_faults = pmc.PageFaultCount;
+#endif
+    return u;
+  }
+
+  /**
+   * Measures a run of operations, and reports its throughput alongside the
+   * memory use of the process and the page faults taken per operation.
+   */
+  class Measure
+  {
+    Usage start = current();
+    std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+
+  public:
+    void report(std::ostream& out, size_t ops) const
+    {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start_time)
+                  .count();
+      Usage end = current();
+      double n = static_cast<double>((ops == 0) ? 1 : ops);
+
+      auto flags = out.flags();
+      out << "  " << ops << " ops, " << std::fixed << std::setprecision(0)
+          << (static_cast<double>(ops) * 1e9 /
+              static_cast<double>((ns == 0) ? 1 : ns))
+          << " ops/s, RSS " << (end.resident >> 10) << " KiB, peak RSS "
+          << (end.peak_resident >> 10) << " KiB, page faults/op "
+          << std::setprecision(4)
+          << (static_cast<double>(end.minor_faults - start.minor_faults) / n)
+          << " minor, "
+          << (static_cast<double>(end.major_faults - start.major_faults) / n)
+          << " major" << std::endl;
+      out.flags(flags);
+    }
+  };
+
+  inline void print_memory()
+  {
+#if defined(__linux__)
+    Usage u = current();
+    std::cout << "Memory info:" << std::endl
+              << "\tResident: " << u.resident << std::endl
+              << "\tPeakResident: " << u.peak_resident << std::endl
+              << "\tProportional: " << u.proportional << std::endl
+              << "\tAnonymous: " << u.anonymous << std::endl
+              << "\tSwap: " << u.swap << std::endl
+              << "\tMinorFaults: " << u.minor_faults << std::endl
+              << "\tMajorFaults: " << u.major_faults << std::endl;
+#elif defined(_WIN32)
     PROCESS_MEMORY_COUNTERS_EX pmc;
 
     if (!GetProcessMemoryInfo(